@@ -3,10 +3,15 @@
 #include "basic_block.h"
 #include "rexcept.h"
 
-CompilerOp* BasicBlock::_add_op(int opcode, int arg, int num_regs) {
+CompilerOp* BasicBlock::new_op(int opcode, int arg, int num_regs) {
   CompilerOp* op = new CompilerOp(opcode, arg);
   op->regs.resize(num_regs);
   alloc_.push_back(op);
+  return op;
+}
+
+CompilerOp* BasicBlock::_add_op(int opcode, int arg, int num_regs) {
+  CompilerOp* op = new_op(opcode, arg, num_regs);
   code.push_back(op);
   return op;
 }
@@ -20,6 +25,7 @@ CompilerOp* BasicBlock::_add_dest_op(int opcode, int arg, int num_regs) {
 BasicBlock::BasicBlock(int offset, int idx, RegisterStack* entry_stack) {
   reg_offset = 0;
   py_offset = offset;
+  handler = NULL;
   visited = 0;
   dead = false;
   this->idx = idx;
@@ -19,6 +19,10 @@ public:
 
   std::vector<BasicBlock*> exits;
   std::vector<BasicBlock*> entries;
+
+  // The landing block of the innermost exception handler covering this
+  // block, or NULL.  Exception edges are not included in exits.
+  BasicBlock* handler;
   std::vector<CompilerOp*> code;
 
   // Have we been visited by the current pass already?
@@ -50,6 +54,9 @@ public:
   CompilerOp* add_dest_op(int opcode, int arg, int reg1, int reg2, int reg3, int reg4, int reg5);
 
   CompilerOp* add_varargs_op(int opcode, int arg, int num_regs);
+
+  /* an operation for the caller to place in code; the block still owns it */
+  CompilerOp* new_op(int opcode, int arg, int num_regs);
 };
 
 
@@ -3,6 +3,8 @@
 #define FALCON_COMPILER_FRAME_H
 
 struct Frame {
+  // SETUP_LOOP, SETUP_EXCEPT or SETUP_FINALLY.
+  int type;
   int target;
   int stack_pos;
 };
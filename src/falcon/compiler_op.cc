@@ -8,8 +8,10 @@ std::string CompilerOp::str() const {
   StringWriter w;
   int num_args = regs.size();
   if (has_dest) {
-    --num_args;
-    w.printf("r%d = ", regs[regs.size() - 1]);
+    num_args -= num_dests;
+    for (size_t i = num_args; i < regs.size(); ++i) {
+      w.printf(i + 1 < regs.size() ? "r%d, " : "r%d = ", regs[i]);
+    }
   }
 
   w.printf("%s", OpUtil::name(code));
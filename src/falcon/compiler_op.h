@@ -20,6 +20,10 @@ struct CompilerOp {
   // is the last register argument a destination we're writing to?
   bool has_dest;
 
+  // The number of trailing destination registers when has_dest is set;
+  // only ops that unpack a value write more than one.
+  int num_dests;
+
   std::vector<int> regs;
 
   std::string str() const;
@@ -29,6 +33,7 @@ struct CompilerOp {
     this->arg = arg;
     this->dead = false;
     this->has_dest = false;
+    this->num_dests = 1;
   }
 
   int dest() {
@@ -41,7 +46,19 @@ struct CompilerOp {
   size_t num_inputs() {
     size_t n = this->regs.size();
     // if one of the registers is a target for a store, don't count it as an input
-    return this->has_dest ? n - 1 : n;
+    return this->has_dest ? n - num_dests : n;
+  }
+
+  bool writes(int reg) {
+    if (!this->has_dest) {
+      return false;
+    }
+    for (size_t i = this->num_inputs(); i < this->regs.size(); ++i) {
+      if (this->regs[i] == reg) {
+        return true;
+      }
+    }
+    return false;
   }
 };
 
@@ -52,7 +52,7 @@ class BackwardPass: public CompilerPass {
 public:
   void visit_bb(BasicBlock* bb) {
     size_t n_ops = bb->code.size();
-    for (size_t i = n_ops - 1; i-- > 0;) {
+    for (size_t i = n_ops; i-- > 0;) {
       CompilerOp* op = bb->code[i];
       if (!op->dead) {
         this->visit_op(op);
@@ -117,9 +117,12 @@ public:
         bb->visited = true;
         this->in_cycle = !(this->all_preds_visited(bb));
         this->visit_bb(bb);
-        int n_exits = bb->exits.size();
-        for (int i = 0; i < n_exits; ++i) {
-          BasicBlock* succ = bb->exits[i];
+        std::vector<BasicBlock*> succs = bb->exits;
+        if (bb->handler != NULL) {
+          succs.push_back(bb->handler);
+        }
+        for (size_t i = 0; i < succs.size(); ++i) {
+          BasicBlock* succ = succs[i];
           if (this->all_preds_visited(succ)) {
             ready.push(succ);
           } else {
@@ -1,4 +1,5 @@
 #include "compiler_state.h"
+#include "opcode.h"
 
 void CompilerState::dump(Writer* w) {
   for (BasicBlock* bb : bbs) {
@@ -31,6 +32,18 @@ BasicBlock* CompilerState::alloc_bb(int offset, RegisterStack* entry_stack) {
   return bb;
 }
 
+void CompilerState::link_handlers() {
+  for (BasicBlock* bb : bbs) {
+    const std::vector<Frame>& frames = bb->entry_stack->frames;
+    for (size_t i = frames.size(); i-- > 0;) {
+      if (frames[i].type != SETUP_LOOP) {
+        bb->handler = handlers[frames[i].target];
+        break;
+      }
+    }
+  }
+}
+
 void CompilerState::remove_bb(BasicBlock* bb) {
   bbs.erase(std::find(bbs.begin(), bbs.end(), bb));
   this->bb_offsets.erase(this->bb_offsets.find(bb->py_offset));
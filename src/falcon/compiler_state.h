@@ -21,6 +21,11 @@ public:
   int num_consts;
   int num_locals;
 
+  // Number of inline cache slots handed out while lowering.
+  int num_attr_caches;
+  int num_global_caches;
+  int num_call_caches;
+
   PyCodeObject* py_code;
   PyObject* consts_tuple;
   unsigned char* py_codestr;
@@ -30,8 +35,11 @@ public:
 
   std::map<int, BasicBlock*> bb_offsets;
 
+  // Landing blocks of the exception handlers, by Python handler offset.
+  std::map<int, BasicBlock*> handlers;
+
   CompilerState() :
-      num_reg(0), num_consts(0), num_locals(0),
+      num_reg(0), num_consts(0), num_locals(0), num_attr_caches(0), num_global_caches(0), num_call_caches(0),
       py_code(NULL),  consts_tuple(NULL),
       py_codestr(NULL), py_codelen(0),
       names(NULL) { }
@@ -43,6 +51,9 @@ public:
     consts_tuple = code->co_consts;
     num_consts = PyTuple_Size(consts_tuple);
     num_locals = code->co_nlocals;
+    num_attr_caches = 0;
+    num_global_caches = 0;
+    num_call_caches = 0;
     // Offset by the number of constants and locals.
     num_reg = num_consts + num_locals;
 //    Log_Info("Consts: %d, locals: %d, first register: %d", num_consts, num_locals, num_reg);
@@ -55,11 +66,24 @@ public:
   }
 
   ~CompilerState() {
+    if (py_code != NULL && consts_tuple != py_code->co_consts) {
+      Py_DECREF(consts_tuple);
+    }
     for (auto bb : alloc_) {
       delete bb;
     }
   }
 
+  // Replace the constants with consts, which extends co_consts, taking the
+  // reference.
+  void set_consts(PyObject* consts) {
+    if (consts_tuple != py_code->co_consts) {
+      Py_DECREF(consts_tuple);
+    }
+    consts_tuple = consts;
+    num_consts = PyTuple_GET_SIZE(consts);
+  }
+
   int num_ops() {
     int total = 0;
     for (auto bb : bbs) {
@@ -70,6 +94,9 @@ public:
 
   BasicBlock* alloc_bb(int offset, RegisterStack* entry_stack);
   void remove_bb(BasicBlock* bb);
+
+  // Set the handler of each block from the try blocks on its entry stack.
+  void link_handlers();
   std::string str();
   void dump(Writer* w);
 };
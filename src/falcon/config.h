@@ -4,8 +4,11 @@
 
 // These defines enable/disable certain optimizations in the
 // evaluator:
+
+// Store ints, floats and bools tagged in registers rather than as objects
+// (see register.h).  "make test" runs the tests with and without.
 #ifndef USED_TYPED_REGISTERS
-#define USED_TYPED_REGISTERS 0
+#define USED_TYPED_REGISTERS 1
 #endif
 
 #ifndef STACK_ALLOC_REGISTERS
@@ -24,5 +27,11 @@
 #define GETATTR_HINTS 1
 #endif
 
+// Calls between compiled functions switch frames inside one eval loop
+// instead of recursing into Evaluator::eval.
+#ifndef INLINE_CALLS
+#define INLINE_CALLS 1
+#endif
+
 
 #endif
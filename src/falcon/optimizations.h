@@ -1,6 +1,7 @@
 #ifndef FALCON_OPTIMIZATIONS_H
 #define FALCON_OPTIMIZATIONS_H
 
+#include <algorithm>
 #include <map>
 
 #include "opcode.h"
@@ -79,6 +80,9 @@ public:
       BasicBlock* next = bb->exits[i];
       next->entries.push_back(bb);
     }
+    if (bb->handler != NULL) {
+      bb->handler->entries.push_back(bb);
+    }
   }
 };
 
@@ -91,7 +95,7 @@ public:
 
     BasicBlock* next = bb->exits[0];
     while (1) {
-      if (next->entries.size() > 1 || next->visited) {
+      if (next->entries.size() > 1 || next->visited || next->handler != bb->handler) {
         break;
       }
 
@@ -120,45 +124,251 @@ public:
   }
 };
 
+// The index of the first register op writes; the registers before it are
+// read.  LOAD_EXCEPTION stores into all of its registers.
+static inline size_t first_write(CompilerOp* op) {
+  if (op->code == LOAD_EXCEPTION) {
+    return 0;
+  }
+  return op->has_dest ? op->num_inputs() : op->regs.size();
+}
+
+// Static single assignment form of a function's registers.
+//
+// The code itself isn't rewritten.  Instead every write of a register gets a
+// new value number, and moves pass on the value of their source, so two
+// registers hold the same value at some point if they have the same number
+// there.  A register which the entries of a block leave holding different
+// values starts the block with a phi value of its own.  Exception handlers
+// can be entered from anywhere in their blocks, so all of their registers
+// start as phis.
+//
+// Globals, attributes, items and cells are modelled as one more register,
+// the heap, which ops that may store to them or run arbitrary code write.
+class SSA {
+public:
+  // register -> value; the heap is register num_reg.
+  typedef std::vector<int> Env;
+
+private:
+  int num_reg_;
+  int num_values_;
+  std::map<std::pair<BasicBlock*, int>, int> phis_;
+  // (op, index of a register it writes, or -1 for the heap) -> value
+  std::map<std::pair<CompilerOp*, int>, int> defs_;
+  // The values at the start of each reachable block.
+  std::map<BasicBlock*, Env> entry_;
+
+  int phi(BasicBlock* bb, int reg) {
+    std::pair<BasicBlock*, int> key(bb, reg);
+    std::map<std::pair<BasicBlock*, int>, int>::iterator iter = phis_.find(key);
+    if (iter != phis_.end()) {
+      return iter->second;
+    }
+    return phis_[key] = num_values_++;
+  }
+
+  void merge(BasicBlock* bb, const Env& env, std::vector<BasicBlock*>* work) {
+    std::map<BasicBlock*, Env>::iterator iter = entry_.find(bb);
+    if (iter == entry_.end()) {
+      entry_[bb] = env;
+      work->push_back(bb);
+      return;
+    }
+
+    bool changed = false;
+    Env& old = iter->second;
+    for (int r = 0; r <= num_reg_; ++r) {
+      if (old[r] != env[r]) {
+        int p = phi(bb, r);
+        if (old[r] != p) {
+          old[r] = p;
+          changed = true;
+        }
+      }
+    }
+    if (changed) {
+      work->push_back(bb);
+    }
+  }
+
+public:
+  static bool is_move(int code) {
+    return code == LOAD_FAST || code == STORE_FAST || code == LOAD_CONST;
+  }
+
+  // Whether op may store to the heap.  Anything that can run Python code
+  // can: attribute and item reads may call descriptors or __getitem__,
+  // operators and comparisons may call user methods, and branches call
+  // __nonzero__.  We don't know operand types here, so only ops that never
+  // run user code are assumed not to.
+  static bool writes_heap(CompilerOp* op) {
+    switch (op->code) {
+    case LOAD_FAST:
+    case STORE_FAST:
+    case LOAD_CONST:
+    case LOAD_GLOBAL:
+    case LOAD_DEREF:
+    case LOAD_CLOSURE:
+    case BUILD_TUPLE:
+    case BUILD_LIST:
+    case BUILD_MAP:
+    case BUILD_SLICE:
+    case JUMP_ABSOLUTE:
+    case JUMP_FORWARD:
+    case BREAK_LOOP:
+    case RETURN_VALUE:
+    case RETURN_VALUES:
+      return false;
+    case COMPARE_OP:
+      return op->arg != PyCmp_IS && op->arg != PyCmp_IS_NOT;
+    }
+    return true;
+  }
+
+  int heap() const {
+    return num_reg_;
+  }
+
+  // The value written to regs[i] of op, or to the heap for i == -1.
+  int def(CompilerOp* op, int i) {
+    std::pair<CompilerOp*, int> key(op, i);
+    std::map<std::pair<CompilerOp*, int>, int>::iterator iter = defs_.find(key);
+    if (iter != defs_.end()) {
+      return iter->second;
+    }
+    return defs_[key] = num_values_++;
+  }
+
+  bool reached(BasicBlock* bb) const {
+    return entry_.count(bb) > 0;
+  }
+
+  const Env& entry(BasicBlock* bb) {
+    return entry_[bb];
+  }
+
+  // Update env to the values after op runs.
+  void step(CompilerOp* op, Env& env) {
+    if (is_move(op->code)) {
+      env[op->regs[1]] = env[op->regs[0]];
+      return;
+    }
+
+    for (size_t i = first_write(op); i < op->regs.size(); ++i) {
+      if (op->regs[i] >= 0) {
+        env[op->regs[i]] = def(op, i);
+      }
+    }
+    if (writes_heap(op)) {
+      env[heap()] = def(op, -1);
+    }
+  }
+
+  void build(CompilerState* fn) {
+    num_reg_ = fn->num_reg;
+    num_values_ = num_reg_ + 1;
+
+    // Registers start out holding their own value.
+    Env env(num_reg_ + 1);
+    for (int r = 0; r <= num_reg_; ++r) {
+      env[r] = r;
+    }
+
+    std::vector<BasicBlock*> work;
+    merge(fn->bbs[0], env, &work);
+    while (!work.empty()) {
+      BasicBlock* bb = work.back();
+      work.pop_back();
+      env = entry_[bb];
+      for (CompilerOp* op : bb->code) {
+        if (!op->dead) {
+          step(op, env);
+        }
+      }
+
+      for (BasicBlock* next : bb->exits) {
+        merge(next, env, &work);
+      }
+      if (bb->handler != NULL && !entry_.count(bb->handler)) {
+        Env phis(num_reg_ + 1);
+        for (int r = 0; r <= num_reg_; ++r) {
+          phis[r] = phi(bb->handler, r);
+        }
+        merge(bb->handler, phis, &work);
+      }
+    }
+  }
+};
+
+// Forward the source of a move to the ops which read its target, for as long
+// as the source still holds the value that was moved.
 class CopyPropagation: public CompilerPass {
+  SSA ssa_;
+
 public:
   void visit_bb(BasicBlock* bb) {
+    if (!ssa_.reached(bb)) {
+      return;
+    }
+
+    SSA::Env values = ssa_.entry(bb);
+    // target -> source
     std::map<int, int> env;
-    size_t n_ops = bb->code.size();
-    int source, target;
-    for (size_t i = 0; i < n_ops; ++i) {
-      CompilerOp * op = bb->code[i];
+    for (CompilerOp* op : bb->code) {
+      if (op->dead) {
+        continue;
+      }
 
       // check all the registers and forward any that are in the env
       size_t n_inputs = op->num_inputs();
       for (size_t reg_idx = 0; reg_idx < n_inputs; reg_idx++) {
-        auto iter = env.find(op->regs[reg_idx]);
-        if (iter != env.end()) {
+        int reg = op->regs[reg_idx];
+        auto iter = env.find(reg);
+        if (iter != env.end() && values[iter->second] == values[reg]) {
           op->regs[reg_idx] = iter->second;
         }
       }
-      if (op->code == LOAD_FAST || op->code == STORE_FAST || op->code == LOAD_CONST) {
-        source = op->regs[0];
-        target = op->regs[1];
-        auto iter = env.find(source);
-        if (iter != env.end()) {
-          source = iter->second;
-        }
-        env[target] = source;
+      if (SSA::is_move(op->code)) {
+        env[op->regs[1]] = op->regs[0];
       }
+      ssa_.step(op, values);
     }
   }
+
+  void visit_fn(CompilerState* fn) {
+    ssa_.build(fn);
+    CompilerPass::visit_fn(fn);
+  }
 };
 
 class StoreElim: public CompilerPass, UseCounts {
+  // Is reg used or written by any op strictly between code[begin] and
+  // code[end]?
+  static bool accessed(BasicBlock* bb, size_t begin, size_t end, int reg) {
+    for (size_t i = begin + 1; i < end; ++i) {
+      CompilerOp* op = bb->code[i];
+      if (op->dead) {
+        continue;
+      }
+      for (int r : op->regs) {
+        if (r == reg) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
 public:
   void visit_bb(BasicBlock* bb) {
-    // map from registers to their last definition in the basic block
-    std::map<int, CompilerOp*> env;
+    // map from registers to the index of their last definition in the basic block
+    std::map<int, size_t> env;
 
     // if we encounter a move X->Y when:
     //   - X is locally defined in the basic block
     //   - X is only used once (for this move)
+    //   - Y isn't used or written between the definition and the move
     // then modify the defining instruction of X
     // to directly write to Y and mark the move X->Y as dead
 
@@ -166,21 +376,27 @@ public:
     int source, target;
     for (size_t i = 0; i < n_ops; ++i) {
       CompilerOp * op = bb->code[i];
-      // check all the registers and forward any that are in the env
-      size_t n_inputs = op->num_inputs();
+      if (op->dead || !op->has_dest) {
+        continue;
+      }
 
-      if (op->has_dest) {
-        target = op->regs[n_inputs];
-        env[target] = op;
-
-        if (op->code == LOAD_FAST || op->code == STORE_FAST) {
-          source = op->regs[0];
-          auto iter = env.find(source);
-          if (iter != env.end() && this->get_count(source) == 1) {
-            CompilerOp* def = iter->second;
-            def->regs[def->num_inputs()] = target;
-            op->dead = true;
+      for (size_t d = op->num_inputs(); d < op->regs.size(); ++d) {
+        env[op->regs[d]] = i;
+      }
+
+      if (op->code == LOAD_FAST || op->code == STORE_FAST) {
+        source = op->regs[0];
+        target = op->regs[1];
+        auto iter = env.find(source);
+        if (iter != env.end() && this->get_count(source) == 1 && !accessed(bb, iter->second, i, target)) {
+          CompilerOp* def = bb->code[iter->second];
+          for (size_t d = def->num_inputs(); d < def->regs.size(); ++d) {
+            if (def->regs[d] == source) {
+              def->regs[d] = target;
+            }
           }
+          op->dead = true;
+          env[target] = iter->second;
         }
       }
     }
@@ -193,6 +409,956 @@ public:
 };
 
 
+// Fold the start of a for loop body into its FOR_ITER:
+//
+//   FOR_ITER(it) -> item; UNPACK_SEQUENCE[2](item) -> a, b
+//
+// (the loop target "a, b") becomes FOR_ITER_PAIR(it) -> a, b, which doesn't
+// store the item, or build it at all for dict.iteritems().
+// The moves of the loop values into locals which follow are then made by the
+// FOR_ITER itself.  Only applies if the body is entered from the FOR_ITER
+// alone and the loop values aren't used elsewhere.
+class FuseForIter: public CompilerPass, UseCounts {
+public:
+  void visit_bb(BasicBlock* bb) {
+    if (bb->code.empty() || bb->code.back()->code != FOR_ITER) {
+      return;
+    }
+
+    CompilerOp* op = bb->code.back();
+    BasicBlock* body = bb->exits[0];
+    if (body->entries.size() != 1) {
+      return;
+    }
+
+    std::vector<CompilerOp*>& code = body->code;
+    int item = op->dest();
+    if (!code.empty() && code[0]->code == UNPACK_SEQUENCE && code[0]->arg == 2 && code[0]->regs[0] == item
+        && this->get_count(item) == 1) {
+      op->code = FOR_ITER_PAIR;
+      op->regs.back() = code[0]->regs[1];
+      op->regs.push_back(code[0]->regs[2]);
+      op->num_dests = 2;
+      code.erase(code.begin());
+    }
+
+    size_t n = 0;
+    while (n < code.size() && code[n]->code == STORE_FAST && op->writes(code[n]->regs[0])
+        && this->get_count(code[n]->regs[0]) == 1) {
+      for (size_t d = op->num_inputs(); d < op->regs.size(); ++d) {
+        if (op->regs[d] == code[n]->regs[0]) {
+          op->regs[d] = code[n]->regs[1];
+        }
+      }
+      ++n;
+    }
+    code.erase(code.begin(), code.begin() + n);
+  }
+
+  void visit_fn(CompilerState* fn) {
+    this->count_uses(fn);
+    CompilerPass::visit_fn(fn);
+  }
+};
+
+// Remove tuples and lists which are taken apart in the basic block that
+// builds them:
+//
+//   - a BUILD_TUPLE or BUILD_LIST whose only uses are UNPACK_SEQUENCE or
+//     subscripts by a constant is replaced by moves from its items;
+//   - "return a, b" becomes RETURN_VALUES(a, b), and "x, y = f()" an
+//     UNPACK_RESULT, so that a compiled callee can store its values straight
+//     into the caller's registers without building the tuple.
+//
+// Items may not be overwritten before the uses being replaced.
+class EscapeAnalysis: public CompilerPass, UseCounts {
+  CompilerState* fn_;
+
+  // The item of a length n sequence read by subscripting it with the
+  // constant in reg, or -1.
+  int const_index(int reg, int n) {
+    if (reg < 0 || reg >= fn_->num_consts) {
+      return -1;
+    }
+    PyObject* key = PyTuple_GET_ITEM(fn_->consts_tuple, reg);
+    if (!PyInt_CheckExact(key)) {
+      return -1;
+    }
+    long i = PyInt_AS_LONG(key);
+    if (i < 0) {
+      i += n;
+    }
+    return i >= 0 && i < n ? i : -1;
+  }
+
+  // Does any op strictly between code[begin] and code[end] write one of regs?
+  static bool written(BasicBlock* bb, size_t begin, size_t end, const std::vector<int>& regs) {
+    for (size_t i = begin + 1; i < end; ++i) {
+      for (int r : regs) {
+        if (bb->code[i]->writes(r)) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  static CompilerOp* move(BasicBlock* bb, int src, int dst) {
+    CompilerOp* op = bb->new_op(LOAD_FAST, 0, 2);
+    op->has_dest = true;
+    op->regs[0] = src;
+    op->regs[1] = dst;
+    return op;
+  }
+
+  // Replace the sequence built by code[i] if all of its uses can be.
+  bool replace_sequence(BasicBlock* bb, size_t i) {
+    CompilerOp* build = bb->code[i];
+    int seq = build->dest();
+    int n = build->num_inputs();
+    std::vector<int> items(build->regs.begin(), build->regs.begin() + n);
+    int uses = this->get_count(seq);
+
+    std::vector<size_t> reads;
+    size_t ret = 0;
+    for (size_t j = i + 1; j < bb->code.size() && (int) reads.size() < uses; ++j) {
+      CompilerOp* op = bb->code[j];
+      size_t n_inputs = op->num_inputs();
+      if (std::find(op->regs.begin(), op->regs.begin() + n_inputs, seq) == op->regs.begin() + n_inputs) {
+        continue;
+      }
+      if (written(bb, i, j, items)) {
+        return false;
+      }
+
+      bool unpack = op->code == UNPACK_SEQUENCE && op->arg == n && op->regs[0] == seq;
+      for (int r : items) {
+        unpack = unpack && !op->writes(r);
+      }
+      if (unpack || (op->code == BINARY_SUBSCR && op->regs[0] == seq && const_index(op->regs[1], n) >= 0)) {
+        reads.push_back(j);
+      } else if (op->code == RETURN_VALUE && build->code == BUILD_TUPLE && uses == 1 && n > 0) {
+        ret = j;
+        reads.push_back(j);
+      } else {
+        return false;
+      }
+    }
+    if ((int) reads.size() != uses) {
+      return false;
+    }
+
+    std::vector<CompilerOp*> code;
+    for (size_t j = 0; j < bb->code.size(); ++j) {
+      CompilerOp* op = bb->code[j];
+      if (j == i) {
+        continue;
+      }
+      if (std::find(reads.begin(), reads.end(), j) == reads.end()) {
+        code.push_back(op);
+      } else if (ret == j) {
+        op->code = RETURN_VALUES;
+        op->arg = n;
+        op->regs = items;
+        code.push_back(op);
+      } else if (op->code == UNPACK_SEQUENCE) {
+        for (int k = 0; k < n; ++k) {
+          code.push_back(move(bb, items[k], op->regs[k + 1]));
+        }
+      } else {
+        code.push_back(move(bb, items[const_index(op->regs[1], n)], op->dest()));
+      }
+    }
+    bb->code = code;
+    return true;
+  }
+
+public:
+  void visit_bb(BasicBlock* bb) {
+    for (size_t i = 0; i < bb->code.size();) {
+      CompilerOp* op = bb->code[i];
+      if ((op->code == BUILD_TUPLE || op->code == BUILD_LIST) && replace_sequence(bb, i)) {
+        continue;
+      }
+
+      if (i > 0 && op->code == UNPACK_SEQUENCE && OpUtil::is_call(bb->code[i - 1]->code)
+          && bb->code[i - 1]->has_dest && bb->code[i - 1]->dest() == op->regs[0] && this->get_count(op->regs[0]) == 1) {
+        op->code = UNPACK_RESULT;
+      }
+      ++i;
+    }
+  }
+
+  void visit_fn(CompilerState* fn) {
+    fn_ = fn;
+    this->count_uses(fn);
+    CompilerPass::visit_fn(fn);
+  }
+};
+
+// Evaluate operations on constants while compiling.
+//
+// Constants are propagated forward through the control flow graph: a
+// register holds a constant at the start of a block if it holds the same
+// one at the end of every predecessor that can be reached.  Arithmetic,
+// comparisons, UNARY_NOT, tuple building and subscripts/slices of constant
+// operands are replaced by moves from their result, which is added to the
+// constant pool.  Conditional branches on a constant become jumps, and the
+// blocks which can no longer be reached are removed.
+//
+// Only immutable builtin values (numbers, strings, None and tuples of them)
+// are folded, so evaluating them can't run Python code; operations which
+// fail are left for the evaluator to raise.  Like CPython's peephole
+// optimizer, sequences longer than kMaxSize aren't added to the pool.
+class ConstantFolding: public CompilerPass {
+  static const int kMaxSize = 20;
+
+  // register -> the constant register it holds
+  typedef std::map<int, int> Env;
+
+  CompilerState* fn_;
+  // Folded values are given the registers from first_folded_ on; those used
+  // by the optimized code are moved in after the existing constants at the
+  // end.  Slices are folded too, but only to fold subscripts by them.
+  int first_folded_;
+  std::vector<PyObject*> folded_;
+  // An op and the constant registers of its inputs -> the constant register
+  // of its result, or -1.
+  std::map<std::pair<CompilerOp*, std::vector<int> >, int> results_;
+  // The registers holding constants at the start of each reachable block.
+  std::map<BasicBlock*, Env> entry_;
+
+  static bool is_constant(PyObject* v) {
+    if (PyTuple_CheckExact(v)) {
+      for (Py_ssize_t i = 0; i < PyTuple_GET_SIZE(v); ++i) {
+        if (!is_constant(PyTuple_GET_ITEM(v, i))) {
+          return false;
+        }
+      }
+      return true;
+    }
+    return v == Py_None || PyInt_CheckExact(v) || PyBool_Check(v) || PyLong_CheckExact(v) || PyFloat_CheckExact(v)
+        || PyComplex_CheckExact(v) || PyString_CheckExact(v) || PyUnicode_CheckExact(v);
+  }
+
+  static bool has_unicode(PyObject* v) {
+    if (PyTuple_CheckExact(v)) {
+      for (Py_ssize_t i = 0; i < PyTuple_GET_SIZE(v); ++i) {
+        if (has_unicode(PyTuple_GET_ITEM(v, i))) {
+          return true;
+        }
+      }
+      return false;
+    }
+    return PyUnicode_CheckExact(v);
+  }
+
+  static bool is_sequence(PyObject* v) {
+    return PyTuple_CheckExact(v) || PyString_CheckExact(v) || PyUnicode_CheckExact(v);
+  }
+
+  // Is v an int no larger than max?  Bounds shifts and powers, which could
+  // otherwise take a long time to evaluate.
+  static bool small_int(PyObject* v, long max) {
+    return PyInt_CheckExact(v) && PyInt_AS_LONG(v) <= max;
+  }
+
+  PyObject* value(int creg) {
+    return creg < fn_->num_consts ? PyTuple_GET_ITEM(fn_->consts_tuple, creg) : folded_[creg - first_folded_];
+  }
+
+  // The constant register reg holds, or -1.
+  int lookup(const Env& env, int reg) {
+    if (reg < 0) {
+      return -1;
+    }
+    if (reg < fn_->num_consts || reg >= first_folded_) {
+      return reg;
+    }
+    Env::const_iterator iter = env.find(reg);
+    return iter == env.end() ? -1 : iter->second;
+  }
+
+  // Can uses of reg be replaced by the constant register creg?
+  bool materializable(int creg) {
+    return creg >= 0 && !PySlice_Check(value(creg));
+  }
+
+  PyObject* binary_op(int code, PyObject* a, PyObject* b) {
+    switch (code) {
+    case BINARY_ADD:
+    case INPLACE_ADD:
+      return PyNumber_Add(a, b);
+    case BINARY_SUBTRACT:
+    case INPLACE_SUBTRACT:
+      return PyNumber_Subtract(a, b);
+    case BINARY_MULTIPLY:
+    case INPLACE_MULTIPLY: {
+      PyObject* seq = is_sequence(a) ? a : is_sequence(b) ? b : NULL;
+      PyObject* n = seq == a ? b : a;
+      if (seq != NULL && !(PyInt_CheckExact(n) && PyInt_AS_LONG(n) <= kMaxSize)) {
+        return NULL;
+      }
+      return PyNumber_Multiply(a, b);
+    }
+    case BINARY_DIVIDE:
+    case INPLACE_DIVIDE:
+      return Py_DivisionWarningFlag ? NULL : PyNumber_Divide(a, b);
+    case BINARY_TRUE_DIVIDE:
+    case INPLACE_TRUE_DIVIDE:
+      return PyNumber_TrueDivide(a, b);
+    case BINARY_FLOOR_DIVIDE:
+    case INPLACE_FLOOR_DIVIDE:
+      return PyNumber_FloorDivide(a, b);
+    case BINARY_MODULO:
+    case INPLACE_MODULO:
+      // String formatting could build an arbitrarily large result.
+      return is_sequence(a) ? NULL : PyNumber_Remainder(a, b);
+    case BINARY_POWER:
+    case INPLACE_POWER:
+      if ((PyInt_CheckExact(b) || PyLong_CheckExact(b)) && !small_int(b, 128)) {
+        return NULL;
+      }
+      return PyNumber_Power(a, b, Py_None);
+    case BINARY_LSHIFT:
+    case INPLACE_LSHIFT:
+      return small_int(b, 128) ? PyNumber_Lshift(a, b) : NULL;
+    case BINARY_RSHIFT:
+    case INPLACE_RSHIFT:
+      return PyNumber_Rshift(a, b);
+    case BINARY_AND:
+    case INPLACE_AND:
+      return PyNumber_And(a, b);
+    case BINARY_XOR:
+    case INPLACE_XOR:
+      return PyNumber_Xor(a, b);
+    case BINARY_OR:
+    case INPLACE_OR:
+      return PyNumber_Or(a, b);
+    case BINARY_SUBSCR:
+      return is_sequence(a) ? PyObject_GetItem(a, b) : NULL;
+    }
+    return NULL;
+  }
+
+  PyObject* compare(int arg, PyObject* a, PyObject* b) {
+    // Comparing str and unicode can warn.
+    if (has_unicode(a) != has_unicode(b)) {
+      return NULL;
+    }
+    switch (arg) {
+    case PyCmp_LT:
+    case PyCmp_LE:
+    case PyCmp_EQ:
+    case PyCmp_NE:
+    case PyCmp_GT:
+    case PyCmp_GE:
+      return PyObject_RichCompare(a, b, arg);
+    case PyCmp_IN:
+    case PyCmp_NOT_IN: {
+      if (!is_sequence(b)) {
+        return NULL;
+      }
+      int r = PySequence_Contains(b, a);
+      return r < 0 ? NULL : PyBool_FromLong(r ^ (arg == PyCmp_NOT_IN));
+    }
+    case PyCmp_IS:
+      return PyBool_FromLong(a == b);
+    case PyCmp_IS_NOT:
+      return PyBool_FromLong(a != b);
+    }
+    return NULL;
+  }
+
+  // Returns a new reference to the result of op on the constants in inputs
+  // (-1 for a missing slice bound), or NULL if it can't be folded.  Doesn't
+  // leave an exception set.
+  PyObject* fold(CompilerOp* op, const std::vector<int>& inputs) {
+    size_t n_inputs = inputs.size();
+    std::vector<PyObject*> args(n_inputs);
+    for (size_t i = 0; i < n_inputs; ++i) {
+      args[i] = inputs[i] < 0 ? NULL : value(inputs[i]);
+      // co_consts also holds code objects; only subscripts take slices.
+      bool slice = op->code == BINARY_SUBSCR && i == 1 && args[i] != NULL && PySlice_Check(args[i]);
+      if (args[i] != NULL && !slice && !is_constant(args[i])) {
+        return NULL;
+      }
+    }
+
+    PyObject* result = NULL;
+    switch (op->code) {
+    case UNARY_POSITIVE:
+      result = PyNumber_Positive(args[0]);
+      break;
+    case UNARY_NEGATIVE:
+      result = PyNumber_Negative(args[0]);
+      break;
+    case UNARY_INVERT:
+      result = PyNumber_Invert(args[0]);
+      break;
+    case UNARY_CONVERT:
+      result = PyObject_Repr(args[0]);
+      break;
+    case UNARY_NOT: {
+      int r = PyObject_Not(args[0]);
+      result = r < 0 ? NULL : PyBool_FromLong(r);
+      break;
+    }
+    case COMPARE_OP:
+      result = compare(op->arg, args[0], args[1]);
+      break;
+    case BUILD_TUPLE:
+      result = PyTuple_New(n_inputs);
+      for (size_t i = 0; result != NULL && i < n_inputs; ++i) {
+        Py_INCREF(args[i]);
+        PyTuple_SET_ITEM(result, i, args[i]);
+      }
+      break;
+    case BUILD_SLICE:
+      // The registers are step, stop, start.
+      result = PySlice_New(args[2], args[1], args[0]);
+      break;
+    case SLICE:
+      if (is_sequence(args[0])) {
+        PyObject* slice = PySlice_New(args[1], args[2], NULL);
+        if (slice != NULL) {
+          result = PyObject_GetItem(args[0], slice);
+          Py_DECREF(slice);
+        }
+      }
+      break;
+    default:
+      result = binary_op(op->code, args[0], args[1]);
+    }
+
+    if (result == NULL) {
+      PyErr_Clear();
+    }
+    return result;
+  }
+
+  static bool foldable(int code) {
+    switch (code) {
+    case UNARY_POSITIVE:
+    case UNARY_NEGATIVE:
+    case UNARY_INVERT:
+    case UNARY_CONVERT:
+    case UNARY_NOT:
+    case COMPARE_OP:
+    case BUILD_TUPLE:
+    case BUILD_SLICE:
+    case SLICE:
+    case BINARY_SUBSCR:
+    case BINARY_ADD:
+    case BINARY_SUBTRACT:
+    case BINARY_MULTIPLY:
+    case BINARY_DIVIDE:
+    case BINARY_TRUE_DIVIDE:
+    case BINARY_FLOOR_DIVIDE:
+    case BINARY_MODULO:
+    case BINARY_POWER:
+    case BINARY_LSHIFT:
+    case BINARY_RSHIFT:
+    case BINARY_AND:
+    case BINARY_XOR:
+    case BINARY_OR:
+    case INPLACE_ADD:
+    case INPLACE_SUBTRACT:
+    case INPLACE_MULTIPLY:
+    case INPLACE_DIVIDE:
+    case INPLACE_TRUE_DIVIDE:
+    case INPLACE_FLOOR_DIVIDE:
+    case INPLACE_MODULO:
+    case INPLACE_POWER:
+    case INPLACE_LSHIFT:
+    case INPLACE_RSHIFT:
+    case INPLACE_AND:
+    case INPLACE_XOR:
+    case INPLACE_OR:
+      return true;
+    }
+    return false;
+  }
+
+  // Is v small enough to add to the constant pool?
+  static bool poolable(PyObject* v) {
+    if (!is_constant(v)) {
+      return false;
+    }
+    if (is_sequence(v)) {
+      return PyObject_Size(v) <= kMaxSize;
+    }
+    return !PyLong_CheckExact(v) || _PyLong_NumBits(v) <= 128;
+  }
+
+  // The constant register holding op's result when it runs with env, or -1.
+  int result(CompilerOp* op, const Env& env) {
+    if (op->code == LOAD_FAST || op->code == STORE_FAST) {
+      return lookup(env, op->regs[0]);
+    }
+    if (!foldable(op->code)) {
+      return -1;
+    }
+
+    std::vector<int> inputs;
+    for (size_t i = 0; i < op->num_inputs(); ++i) {
+      int creg = lookup(env, op->regs[i]);
+      bool optional = (op->code == SLICE || op->code == BUILD_SLICE) && op->regs[i] < 0;
+      if (creg < 0 && !optional) {
+        return -1;
+      }
+      inputs.push_back(creg);
+    }
+
+    std::pair<CompilerOp*, std::vector<int> > key(op, inputs);
+    std::map<std::pair<CompilerOp*, std::vector<int> >, int>::iterator iter = results_.find(key);
+    if (iter != results_.end()) {
+      return iter->second;
+    }
+
+    int creg = -1;
+    PyObject* v = fold(op, inputs);
+    if (v != NULL && (PySlice_Check(v) || poolable(v))) {
+      creg = first_folded_ + folded_.size();
+      folded_.push_back(v);
+    } else {
+      Py_XDECREF(v);
+    }
+    results_[key] = creg;
+    return creg;
+  }
+
+  void step(CompilerOp* op, Env& env) {
+    if (!op->has_dest) {
+      return;
+    }
+    int creg = result(op, env);
+    for (size_t d = op->num_inputs(); d < op->regs.size(); ++d) {
+      env.erase(op->regs[d]);
+    }
+    if (creg >= 0) {
+      env[op->dest()] = creg;
+    }
+  }
+
+  // The exit a block ending in a conditional branch on a constant takes,
+  // or -1.
+  int taken_exit(BasicBlock* bb, const Env& env) {
+    if (bb->code.empty()) {
+      return -1;
+    }
+    CompilerOp* op = bb->code.back();
+    if (op->dead || (op->code != POP_JUMP_IF_FALSE && op->code != POP_JUMP_IF_TRUE)) {
+      return -1;
+    }
+    int creg = lookup(env, op->regs[0]);
+    if (creg < 0) {
+      return -1;
+    }
+    int truth = PyObject_IsTrue(value(creg));
+    if (truth < 0) {
+      PyErr_Clear();
+      return -1;
+    }
+    // exits[1] is the branch target.
+    return truth == (op->code == POP_JUMP_IF_TRUE) ? 1 : 0;
+  }
+
+  void merge(BasicBlock* bb, const Env& env, std::vector<BasicBlock*>* work) {
+    std::map<BasicBlock*, Env>::iterator iter = entry_.find(bb);
+    if (iter == entry_.end()) {
+      entry_[bb] = env;
+      work->push_back(bb);
+      return;
+    }
+
+    bool changed = false;
+    Env& old = iter->second;
+    for (Env::iterator i = old.begin(); i != old.end();) {
+      Env::const_iterator j = env.find(i->first);
+      if (j == env.end() || j->second != i->second) {
+        old.erase(i++);
+        changed = true;
+      } else {
+        ++i;
+      }
+    }
+    if (changed) {
+      work->push_back(bb);
+    }
+  }
+
+  // Find the constants at the start of each reachable block.  Exception
+  // handlers can be entered from anywhere in their blocks, so start with
+  // none.
+  void analyze(CompilerState* fn) {
+    std::vector<BasicBlock*> work;
+    merge(fn->bbs[0], Env(), &work);
+    while (!work.empty()) {
+      BasicBlock* bb = work.back();
+      work.pop_back();
+      Env env = entry_[bb];
+      for (CompilerOp* op : bb->code) {
+        if (!op->dead) {
+          step(op, env);
+        }
+      }
+
+      int taken = taken_exit(bb, env);
+      for (size_t i = 0; i < bb->exits.size(); ++i) {
+        if (taken < 0 || (int) i == taken) {
+          merge(bb->exits[i], env, &work);
+        }
+      }
+      if (bb->handler != NULL) {
+        merge(bb->handler, Env(), &work);
+      }
+    }
+  }
+
+  // Returns the number of ops folded.
+  int rewrite(BasicBlock* bb) {
+    int num_folded = 0;
+    Env env = entry_[bb];
+    for (CompilerOp* op : bb->code) {
+      if (op->dead) {
+        continue;
+      }
+      for (size_t i = 0; i < op->num_inputs(); ++i) {
+        int creg = lookup(env, op->regs[i]);
+        if (materializable(creg)) {
+          op->regs[i] = creg;
+        }
+      }
+
+      int creg = result(op, env);
+      if (foldable(op->code) && materializable(creg)) {
+        int dest = op->dest();
+        op->code = LOAD_FAST;
+        op->arg = 0;
+        op->regs.clear();
+        op->regs.push_back(creg);
+        op->regs.push_back(dest);
+        ++num_folded;
+      }
+      step(op, env);
+    }
+
+    int taken = taken_exit(bb, env);
+    if (taken >= 0) {
+      CompilerOp* op = bb->code.back();
+      BasicBlock* target = bb->exits[taken];
+      op->code = JUMP_ABSOLUTE;
+      op->arg = target->py_offset;
+      op->regs.clear();
+      bb->exits.clear();
+      bb->exits.push_back(target);
+    }
+    return num_folded;
+  }
+
+  // Give the folded constants which are used the registers after the
+  // existing constants.
+  void renumber(CompilerState* fn) {
+    std::map<int, int> moved;
+    std::vector<PyObject*> used;
+    for (BasicBlock* bb : fn->bbs) {
+      for (CompilerOp* op : bb->code) {
+        for (int r : op->regs) {
+          if (r >= first_folded_ && !moved.count(r)) {
+            moved[r] = fn->num_consts + used.size();
+            used.push_back(folded_[r - first_folded_]);
+          }
+        }
+      }
+    }
+
+    int k = used.size();
+    for (BasicBlock* bb : fn->bbs) {
+      for (CompilerOp* op : bb->code) {
+        for (size_t i = 0; i < op->regs.size(); ++i) {
+          int& r = op->regs[i];
+          if (r >= first_folded_) {
+            r = moved[r];
+          } else if (r >= fn->num_consts) {
+            r += k;
+          }
+        }
+      }
+    }
+
+    PyObject* consts = PyTuple_New(fn->num_consts + k);
+    for (int i = 0; i < fn->num_consts; ++i) {
+      PyObject* v = PyTuple_GET_ITEM(fn->consts_tuple, i);
+      Py_INCREF(v);
+      PyTuple_SET_ITEM(consts, i, v);
+    }
+    for (int i = 0; i < k; ++i) {
+      Py_INCREF(used[i]);
+      PyTuple_SET_ITEM(consts, fn->num_consts + i, used[i]);
+    }
+    fn->set_consts(consts);
+    fn->num_reg += k;
+    COMPILE_LOG("Constant folding: %d new constants", k);
+  }
+
+public:
+  ~ConstantFolding() {
+    for (PyObject* v : folded_) {
+      Py_DECREF(v);
+    }
+  }
+
+  void visit_fn(CompilerState* fn) {
+    // Folding could emit the warnings Python's -3 flag enables.
+    if (Py_Py3kWarningFlag) {
+      return;
+    }
+    fn_ = fn;
+    first_folded_ = fn->num_reg;
+    analyze(fn);
+
+    int num_folded = 0;
+    int removed = 0;
+    for (BasicBlock* bb : fn->bbs) {
+      if (bb->dead) {
+        continue;
+      }
+      if (entry_.count(bb)) {
+        num_folded += rewrite(bb);
+      } else {
+        bb->dead = true;
+        bb->code.clear();
+        ++removed;
+      }
+    }
+    COMPILE_LOG("Constant folding: %d ops folded, %d unreachable blocks removed", num_folded, removed);
+
+    // Blocks may now have a single entry, and can be merged.
+    for (BasicBlock* bb : fn->bbs) {
+      bb->entries.clear();
+    }
+    MarkEntries()(fn);
+    FuseBasicBlocks()(fn);
+
+    renumber(fn);
+  }
+};
+
+// Global value numbering: replace ops which recompute a value that some
+// register still holds by a move from that register.
+//
+// Two ops compute the same value if they have the same opcode, argument and
+// SSA input values.  Loads also take the value of the heap, so a store or a
+// call between them on any path keeps them apart.  Blocks are visited down
+// the dominator tree, with the ops of their dominators in scope.
+//
+// Only ops which can't run Python code are numbered: global and cell loads,
+// which return an existing object, and identity tests.  Attribute and item
+// reads may call a property or __getitem__, and operators and slices may build
+// a new (mutable) object each time, so they are left alone.
+class ValueNumbering: public CompilerPass {
+  // (opcode, arg), input values
+  typedef std::pair<std::pair<int, int>, std::vector<int> > Key;
+
+  struct Available {
+    int value;
+    int reg;
+  };
+
+  SSA ssa_;
+  // Values found to be equal to an earlier one -> that value.
+  std::map<int, int> leader_;
+  std::map<Key, Available> available_;
+  std::map<BasicBlock*, std::vector<BasicBlock*> > children_;
+  int num_replaced_;
+
+  int leader(int value) {
+    std::map<int, int>::iterator iter = leader_.find(value);
+    return iter == leader_.end() ? value : iter->second;
+  }
+
+  static std::vector<BasicBlock*> successors(BasicBlock* bb) {
+    std::vector<BasicBlock*> succs = bb->exits;
+    if (bb->handler != NULL) {
+      succs.push_back(bb->handler);
+    }
+    return succs;
+  }
+
+  // Build the dominator tree of the reachable blocks, using the algorithm
+  // of Cooper, Harvey and Kennedy.
+  void dominators(CompilerState* fn) {
+    // Number the blocks in reverse postorder.
+    std::vector<BasicBlock*> order;
+    std::map<BasicBlock*, int> index;
+    std::vector<std::pair<BasicBlock*, size_t> > stack;
+    stack.push_back(std::make_pair(fn->bbs[0], 0));
+    index[fn->bbs[0]] = -1;
+    while (!stack.empty()) {
+      BasicBlock* bb = stack.back().first;
+      std::vector<BasicBlock*> succs = successors(bb);
+      size_t& next = stack.back().second;
+      if (next < succs.size()) {
+        BasicBlock* succ = succs[next++];
+        if (!index.count(succ)) {
+          index[succ] = -1;
+          stack.push_back(std::make_pair(succ, 0));
+        }
+      } else {
+        order.push_back(bb);
+        stack.pop_back();
+      }
+    }
+    std::reverse(order.begin(), order.end());
+
+    std::vector<std::vector<int> > preds(order.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+      index[order[i]] = i;
+    }
+    for (size_t i = 0; i < order.size(); ++i) {
+      for (BasicBlock* succ : successors(order[i])) {
+        preds[index[succ]].push_back(i);
+      }
+    }
+
+    std::vector<int> idom(order.size(), -1);
+    idom[0] = 0;
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (size_t i = 1; i < order.size(); ++i) {
+        int dom = -1;
+        for (int p : preds[i]) {
+          if (idom[p] < 0) {
+            continue;
+          }
+          if (dom < 0) {
+            dom = p;
+            continue;
+          }
+          int a = p;
+          while (a != dom) {
+            while (a > dom) {
+              a = idom[a];
+            }
+            while (dom > a) {
+              dom = idom[dom];
+            }
+          }
+        }
+        if (idom[i] != dom) {
+          idom[i] = dom;
+          changed = true;
+        }
+      }
+    }
+
+    for (size_t i = 1; i < order.size(); ++i) {
+      children_[order[idom[i]]].push_back(order[i]);
+    }
+  }
+
+  // The key of the value op computes with the values in env, if it is
+  // numbered.
+  bool key(CompilerOp* op, const SSA::Env& env, Key* key) {
+    if (!op->has_dest || op->num_dests != 1) {
+      return false;
+    }
+
+    bool load = false;
+    switch (op->code) {
+    case LOAD_GLOBAL:
+    case LOAD_DEREF:
+      load = true;
+      break;
+    case LOAD_CLOSURE:
+    case BUILD_SLICE:
+      break;
+    case COMPARE_OP:
+      if (op->arg != PyCmp_IS && op->arg != PyCmp_IS_NOT) {
+        return false;
+      }
+      break;
+    default:
+      return false;
+    }
+
+    key->first = std::make_pair(op->code, op->arg);
+    key->second.clear();
+    for (size_t i = 0; i < op->num_inputs(); ++i) {
+      int reg = op->regs[i];
+      key->second.push_back(reg < 0 ? -1 : leader(env[reg]));
+    }
+    if (load) {
+      key->second.push_back(leader(env[ssa_.heap()]));
+    }
+    return true;
+  }
+
+  void visit_tree(BasicBlock* bb) {
+    // The entries this block replaced, to restore when leaving its subtree.
+    std::vector<std::pair<Key, Available> > shadowed;
+
+    SSA::Env env = ssa_.entry(bb);
+    for (CompilerOp* op : bb->code) {
+      if (op->dead) {
+        continue;
+      }
+
+      Key k;
+      if (key(op, env, &k)) {
+        std::map<Key, Available>::iterator iter = available_.find(k);
+        int dest = op->dest();
+        if (iter != available_.end() && leader(env[iter->second.reg]) == iter->second.value) {
+          Available prev = iter->second;
+          leader_[ssa_.def(op, op->regs.size() - 1)] = prev.value;
+          if (prev.reg == dest) {
+            op->dead = true;
+          } else {
+            op->code = LOAD_FAST;
+            op->arg = 0;
+            op->regs.clear();
+            op->regs.push_back(prev.reg);
+            op->regs.push_back(dest);
+          }
+          ++num_replaced_;
+        } else {
+          Available none = { -1, -1 };
+          shadowed.push_back(std::make_pair(k, iter == available_.end() ? none : iter->second));
+          Available avail = { ssa_.def(op, op->regs.size() - 1), dest };
+          available_[k] = avail;
+        }
+      }
+
+      if (!op->dead) {
+        ssa_.step(op, env);
+      }
+    }
+
+    for (BasicBlock* child : children_[bb]) {
+      visit_tree(child);
+    }
+
+    for (size_t i = shadowed.size(); i-- > 0;) {
+      if (shadowed[i].second.reg < 0) {
+        available_.erase(shadowed[i].first);
+      } else {
+        available_[shadowed[i].first] = shadowed[i].second;
+      }
+    }
+  }
+
+public:
+  void visit_fn(CompilerState* fn) {
+    num_replaced_ = 0;
+    ssa_.build(fn);
+    dominators(fn);
+    visit_tree(fn->bbs[0]);
+    COMPILE_LOG("Value numbering: %d ops replaced", num_replaced_);
+  }
+};
+
 class RenameRegisters: public CompilerPass {
   // simple renaming that ignore live ranges of registers
 private:
@@ -258,83 +1424,190 @@ public:
   }
 };
 
-class CompactRegisters: public SortedPass, UseCounts {
+// Give the temporaries registers by colouring their interference graph.
+//
+// Liveness is computed over the control flow graph, including the exception
+// edges: the registers live into a handler are live throughout the blocks it
+// covers.  Two temporaries interfere if one is written while the other is
+// live, except that the target of a move doesn't interfere with its source.
+// Temporaries are coloured greedily in order of appearance, preferring the
+// register of the other side of a move, and moves left with the same source
+// and target are removed.  Constants and locals keep their registers.
+class RegisterAllocation: public CompilerPass {
 private:
-  // Mapping from old -> new register names
-  std::map<int, int> register_map;
-  std::stack<int> free_registers;
-  int num_frozen;
-  int max_register;
-
-  std::set<int> bb_defs;
-  bool defined_locally(int r) {
-    return bb_defs.find(r) != bb_defs.end();
+  int num_frozen_;
+  std::map<BasicBlock*, std::set<int> > live_in_;
+  std::map<int, std::set<int> > interferes_;
+  // temporary -> the temporaries it is moved to or from
+  std::map<int, std::set<int> > moves_;
+  // The temporaries in order of appearance.
+  std::vector<int> temps_;
+
+  bool is_temp(int reg) {
+    return reg >= num_frozen_;
   }
 
-public:
+  std::set<int> live_out(BasicBlock* bb) {
+    std::set<int> live;
+    for (BasicBlock* next : bb->exits) {
+      live.insert(live_in_[next].begin(), live_in_[next].end());
+    }
+    if (bb->handler != NULL) {
+      live.insert(live_in_[bb->handler].begin(), live_in_[bb->handler].end());
+    }
+    return live;
+  }
 
-  void visit_op(CompilerOp* op) {
+  // Update live from the end of bb to its start, adding the interference
+  // between each register written and the ones live after it if interfere
+  // is set.
+  void scan(BasicBlock* bb, std::set<int>* live, bool interfere) {
+    const std::set<int>* handler_live = bb->handler != NULL ? &live_in_[bb->handler] : NULL;
+    for (size_t i = bb->code.size(); i-- > 0;) {
+      CompilerOp* op = bb->code[i];
+      if (op->dead) {
+        continue;
+      }
 
-    size_t n_regs = op->regs.size();
-    size_t n_input_regs;
-    if (op->has_dest) {
-      n_input_regs = n_regs - 1;
-    } else {
-      n_input_regs = n_regs;
-    }
-    int old_reg;
-    int new_reg;
-    for (size_t i = 0; i < n_input_regs; ++i) {
-      old_reg = op->regs[i];
-      if (old_reg >= num_frozen) {
-        new_reg = register_map[old_reg];
-        if (new_reg != 0) {
-          op->regs[i] = new_reg;
-          this->decr_count(old_reg);
-          if (this->get_count(old_reg) == 0) {
-            if (!this->in_cycle || this->defined_locally(old_reg)) {
-              this->free_registers.push(new_reg);
+      size_t first = first_write(op);
+      if (interfere) {
+        int source = SSA::is_move(op->code) ? op->regs[0] : -1;
+        for (size_t d = first; d < op->regs.size(); ++d) {
+          int r = op->regs[d];
+          if (!is_temp(r)) {
+            continue;
+          }
+          for (int l : *live) {
+            if (l != r && l != source) {
+              interferes_[r].insert(l);
+              interferes_[l].insert(r);
             }
           }
+          // The destinations of one op are written together.
+          for (size_t e = first; e < op->regs.size(); ++e) {
+            if (op->regs[e] != r && is_temp(op->regs[e])) {
+              interferes_[r].insert(op->regs[e]);
+            }
+          }
+        }
+      }
+
+      for (size_t d = first; d < op->regs.size(); ++d) {
+        live->erase(op->regs[d]);
+      }
+      for (size_t u = 0; u < first; ++u) {
+        if (is_temp(op->regs[u])) {
+          live->insert(op->regs[u]);
         }
       }
+      if (handler_live != NULL) {
+        live->insert(handler_live->begin(), handler_live->end());
+      }
     }
-    if (op->has_dest) {
-      old_reg = op->regs[n_input_regs];
-      if (old_reg >= 0) {
-        bb_defs.insert(old_reg);
-        if (register_map.find(old_reg) != register_map.end()) {
-          new_reg = register_map[old_reg];
-        } else if (free_registers.size() > 0) {
-          new_reg = free_registers.top();
-          free_registers.pop();
-          register_map[old_reg] = new_reg;
-        } else {
-          new_reg = max_register;
-          register_map[old_reg] = new_reg;
-          max_register++;
+  }
+
+  void liveness(CompilerState* fn) {
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (size_t i = fn->bbs.size(); i-- > 0;) {
+        BasicBlock* bb = fn->bbs[i];
+        if (bb->dead) {
+          continue;
+        }
+        std::set<int> live = live_out(bb);
+        scan(bb, &live, false);
+        if (live != live_in_[bb]) {
+          live_in_[bb] = live;
+          changed = true;
         }
-        op->regs[n_input_regs] = new_reg;
       }
     }
   }
 
-  void visit_bb(BasicBlock* bb) {
-    this->bb_defs.clear();
-    SortedPass::visit_bb(bb);
+  void build_graph(CompilerState* fn) {
+    std::set<int> seen;
+    for (BasicBlock* bb : fn->bbs) {
+      if (bb->dead) {
+        continue;
+      }
+      std::set<int> live = live_out(bb);
+      scan(bb, &live, true);
 
+      for (CompilerOp* op : bb->code) {
+        if (op->dead) {
+          continue;
+        }
+        for (int r : op->regs) {
+          if (is_temp(r) && seen.insert(r).second) {
+            temps_.push_back(r);
+          }
+        }
+        if (SSA::is_move(op->code) && is_temp(op->regs[0]) && is_temp(op->regs[1])) {
+          moves_[op->regs[0]].insert(op->regs[1]);
+          moves_[op->regs[1]].insert(op->regs[0]);
+        }
+      }
+    }
   }
+
+public:
   void visit_fn(CompilerState* fn) {
+    num_frozen_ = fn->num_consts + fn->num_locals;
+    liveness(fn);
+    build_graph(fn);
+
+    // temporary -> colour
+    std::map<int, int> colour;
+    int num_colours = 0;
+    for (int t : temps_) {
+      std::set<int> taken;
+      for (int n : interferes_[t]) {
+        std::map<int, int>::iterator iter = colour.find(n);
+        if (iter != colour.end()) {
+          taken.insert(iter->second);
+        }
+      }
 
-    this->count_uses(fn);
+      int c = -1;
+      for (int m : moves_[t]) {
+        std::map<int, int>::iterator iter = colour.find(m);
+        if (iter != colour.end() && !taken.count(iter->second)) {
+          c = iter->second;
+          break;
+        }
+      }
+      if (c < 0) {
+        c = 0;
+        while (taken.count(c)) {
+          ++c;
+        }
+      }
+      colour[t] = c;
+      num_colours = std::max(num_colours, c + 1);
+    }
 
-    // don't rename inputs, locals, or constants
-    num_frozen = fn->num_locals + fn->num_consts;
-    max_register = num_frozen;
-    for (int i = 0; i < max_register; ++i) {
-      register_map[i] = i;
+    int num_moves = 0;
+    for (BasicBlock* bb : fn->bbs) {
+      std::vector<CompilerOp*> code;
+      for (CompilerOp* op : bb->code) {
+        for (size_t i = 0; i < op->regs.size(); ++i) {
+          if (is_temp(op->regs[i])) {
+            op->regs[i] = num_frozen_ + colour[op->regs[i]];
+          }
+        }
+        if (SSA::is_move(op->code) && op->regs[0] == op->regs[1]) {
+          ++num_moves;
+          continue;
+        }
+        code.push_back(op);
+      }
+      bb->code = code;
     }
-    SortedPass::visit_fn(fn);
+
+    COMPILE_LOG("Register allocation: %d temporaries in %d registers, %d moves removed; %d registers before, %d after",
+                (int) temps_.size(), num_colours, num_moves, fn->num_reg, num_frozen_ + num_colours);
+    fn->num_reg = num_frozen_ + num_colours;
   }
 };
 
@@ -407,7 +1680,6 @@ public:
 
         size_t n_inputs = op->num_inputs();
         if (op->has_dest) {
-          int dest = op->regs[n_inputs];
           StaticType t = OBJ;
           switch (op->code) {
           case BUILD_LIST:
@@ -437,7 +1709,9 @@ public:
           }
             break;
           }
-          this->update_type(dest, t);
+          for (size_t d = n_inputs; d < op->regs.size(); ++d) {
+            this->update_type(op->regs[d], t);
+          }
         }
       }
     }
@@ -592,12 +1866,95 @@ public:
   }
 };
 
+// Rewrite "LOAD_ATTR obj.name; CALL_FUNCTION" pairs into LOAD_METHOD and
+// CALL_METHOD, which let the evaluator skip creating a bound method.
+//
+// CALL_METHOD gets obj as an extra register after the function.  The pair is
+// only rewritten if both ops are in the same basic block, the attribute is
+// only used as the callee and obj is not overwritten in between.
+class MethodCalls: public CompilerPass, UseCounts {
+public:
+  void visit_bb(BasicBlock* bb) {
+    // attribute register -> index of the LOAD_ATTR defining it
+    std::map<int, size_t> loads;
+    // index of a convertible LOAD_ATTR -> index of its call
+    std::map<size_t, size_t> pairs;
+
+    size_t n_ops = bb->code.size();
+    for (size_t i = 0; i < n_ops; ++i) {
+      CompilerOp* op = bb->code[i];
+      if (op->dead) {
+        continue;
+      }
+
+      if (op->code == CALL_FUNCTION) {
+        std::map<int, size_t>::iterator load = loads.find(op->regs[0]);
+        if (load != loads.end() && this->get_count(op->regs[0]) == 1) {
+          pairs[load->second] = i;
+          loads.erase(load);
+        }
+      }
+
+      if (op->has_dest) {
+        // A write to the object of a pending load invalidates it.
+        for (std::map<int, size_t>::iterator iter = loads.begin(); iter != loads.end();) {
+          if (op->writes(bb->code[iter->second]->regs[0])) {
+            loads.erase(iter++);
+          } else {
+            ++iter;
+          }
+        }
+      }
+
+      if (op->code == LOAD_ATTR) {
+        loads[op->dest()] = i;
+      }
+    }
+
+    // Pairs nest properly within a basic block; the evaluator tracks pending
+    // pairs in a fixed size bit stack, so skip any nested too deeply.
+    std::vector<size_t> open_calls;
+    for (size_t i = 0; i < n_ops; ++i) {
+      if (!open_calls.empty() && open_calls.back() == i) {
+        open_calls.pop_back();
+        continue;
+      }
+
+      std::map<size_t, size_t>::iterator pair = pairs.find(i);
+      if (pair == pairs.end() || open_calls.size() >= (size_t) kMaxMethodDepth) {
+        continue;
+      }
+
+      CompilerOp* load = bb->code[i];
+      CompilerOp* call = bb->code[pair->second];
+      load->code = LOAD_METHOD;
+      call->code = CALL_METHOD;
+      call->regs.insert(call->regs.begin() + 1, load->regs[0]);
+      open_calls.push_back(pair->second);
+    }
+  }
+
+  void visit_fn(CompilerState* fn) {
+    this->count_uses(fn);
+    CompilerPass::visit_fn(fn);
+  }
+};
+
+// New switches must also be added to kCompileSwitches in rcache.cc.
 void optimize(CompilerState* fn) {
   MarkEntries()(fn);
   FuseBasicBlocks()(fn);
 
   if (!getenv("DISABLE_OPT")) {
+    if (!getenv("DISABLE_FUSE_FOR_ITER")) FuseForIter()(fn);
     if (!getenv("DISABLE_COPY")) CopyPropagation()(fn);
+    if (!getenv("DISABLE_ESCAPE")) EscapeAnalysis()(fn);
+    if (!getenv("DISABLE_CONSTANT_FOLDING")) ConstantFolding()(fn);
+    if (!getenv("DISABLE_GVN")) {
+      ValueNumbering()(fn);
+      // Forward the moves which replaced recomputed values.
+      if (!getenv("DISABLE_COPY")) CopyPropagation()(fn);
+    }
     if (!getenv("DISABLE_STORE")) StoreElim()(fn);
   }
 
@@ -609,7 +1966,10 @@ void optimize(CompilerState* fn) {
 
   DeadCodeElim()(fn);
   if (!getenv("DISABLE_OPT")) {
-    if (!getenv("DISABLE_COMPACT")) CompactRegisters()(fn);
+    if (!getenv("DISABLE_METHOD_CALLS")) MethodCalls()(fn);
+  }
+  if (!getenv("DISABLE_OPT")) {
+    if (!getenv("DISABLE_REGISTER_ALLOCATION")) RegisterAllocation()(fn);
   }
 
   RenameRegisters()(fn);
@@ -130,6 +130,12 @@ const char* OpUtil::name(int opcode) {
     case DICT_CONTAINS : return "DICT_CONTAINS";
     case STORE_SUBSCR_LIST : return "STORE_SUBSCR_LIST";
     case STORE_SUBSCR_DICT : return "STORE_SUBSCR_DICT";
+    case LOAD_METHOD : return "LOAD_METHOD";
+    case CALL_METHOD : return "CALL_METHOD";
+    case LOAD_EXCEPTION : return "LOAD_EXCEPTION";
+    case FOR_ITER_PAIR : return "FOR_ITER_PAIR";
+    case RETURN_VALUES : return "RETURN_VALUES";
+    case UNPACK_RESULT : return "UNPACK_RESULT";
 
   }
 
@@ -14,15 +14,34 @@
 #define DICT_CONTAINS 153
 #define STORE_SUBSCR_LIST 154
 #define STORE_SUBSCR_DICT 155
+#define LOAD_METHOD 156
+#define CALL_METHOD 157
+#define LOAD_EXCEPTION 158
+#define FOR_ITER_PAIR 159
+#define RETURN_VALUES 160
+#define UNPACK_RESULT 161
 
 struct OpUtil {
   static const char* name(int opcode);
 
   static bool has_hint(int opcode) {
-    if (opcode == LOAD_ATTR) {
+    if (opcode == LOAD_ATTR || opcode == LOAD_METHOD || opcode == STORE_ATTR || opcode == LOAD_GLOBAL) {
       return true;
     }
-    return false;
+    return is_call(opcode);
+  }
+
+  static bool is_call(int opcode) {
+    switch (opcode) {
+    case CALL_FUNCTION:
+    case CALL_FUNCTION_VAR:
+    case CALL_FUNCTION_KW:
+    case CALL_FUNCTION_VAR_KW:
+    case CALL_METHOD:
+      return true;
+    default:
+      return false;
+    }
   }
 
   static bool is_varargs(int opcode) {
@@ -32,12 +51,16 @@ struct OpUtil {
       r.insert(CALL_FUNCTION_KW);
       r.insert(CALL_FUNCTION_VAR);
       r.insert(CALL_FUNCTION_VAR_KW);
+      r.insert(CALL_METHOD);
       r.insert(BUILD_LIST);
       r.insert(BUILD_TUPLE);
 //      r.insert(BUILD_MAP);
       r.insert(BUILD_SET);
       r.insert(MAKE_FUNCTION);
       r.insert(MAKE_CLOSURE);
+      r.insert(UNPACK_SEQUENCE);
+      r.insert(UNPACK_RESULT);
+      r.insert(RETURN_VALUES);
     }
 
     return r.find(opcode) != r.end();
@@ -47,6 +70,7 @@ struct OpUtil {
     static std::set<int> r;
     if (r.empty()) {
       r.insert(FOR_ITER);
+      r.insert(FOR_ITER_PAIR);
       r.insert(JUMP_IF_FALSE_OR_POP);
       r.insert(JUMP_IF_TRUE_OR_POP);
       r.insert(POP_JUMP_IF_FALSE);
@@ -67,6 +91,7 @@ struct OpUtil {
       r.insert(LOAD_GLOBAL);
       r.insert(LOAD_NAME);
       r.insert(LOAD_ATTR);
+      r.insert(LOAD_METHOD);
       r.insert(STORE_GLOBAL);
       r.insert(STORE_NAME);
       r.insert(STORE_ATTR);
@@ -75,14 +100,20 @@ struct OpUtil {
       r.insert(CALL_FUNCTION_KW);
       r.insert(CALL_FUNCTION_VAR);
       r.insert(CALL_FUNCTION_VAR_KW);
+      r.insert(CALL_METHOD);
       r.insert(MAKE_FUNCTION);
       r.insert(BUILD_LIST);
       r.insert(BUILD_TUPLE);
       r.insert(BUILD_MAP);
       r.insert(BUILD_SET);
+      r.insert(UNPACK_SEQUENCE);
+      r.insert(UNPACK_RESULT);
+      r.insert(RETURN_VALUES);
       r.insert(IMPORT_NAME);
       r.insert(IMPORT_FROM);
       r.insert(CONTINUE_LOOP);
+      r.insert(RAISE_VARARGS);
+      r.insert(LOAD_EXCEPTION);
     }
 
     return r.find(opcode) != r.end();
@@ -0,0 +1,290 @@
+#include "Python.h"
+#include "marshal.h"
+
+#include "rcache.h"
+#include "rinst.h"
+#include "util.h"
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <string>
+
+// Bump when the layout of CachedCodeHeader changes.
+static const uint32_t kCacheFormat = 3;
+static const char kCacheMagic[4] = { 'F', 'R', 'C', '\0' };
+
+struct CachedCodeHeader {
+  char magic[4];
+  uint32_t format;
+  uint64_t key;
+
+  int16_t num_registers;
+  int16_t num_freevars;
+  int16_t num_cellvars;
+  int16_t num_cells;
+  uint16_t num_attr_caches;
+  uint16_t num_global_caches;
+  uint16_t num_call_caches;
+  int16_t num_handlers;
+
+  // Followed by the instructions, the exception handler table and then the
+  // constants added by constant folding, as a marshalled tuple.
+  uint64_t instructions_size;
+  uint64_t consts_size;
+};
+
+static uint64_t fnv_hash(uint64_t h, const char* data, size_t len) {
+  for (size_t i = 0; i < len; ++i) {
+    h ^= (unsigned char) data[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+// Identifies the Falcon build: instruction layouts and opcode numbers change
+// between builds, so cached code is only valid for the library that wrote it.
+static uint64_t build_key() {
+  static uint64_t key = 0;
+  if (key != 0) {
+    return key;
+  }
+
+  std::string id = StringPrintf("format=%d typed=%d hints=%d pack=%d", kCacheFormat, USED_TYPED_REGISTERS,
+                                GETATTR_HINTS, PACK_INSTRUCTIONS);
+  Dl_info info;
+  struct stat st;
+  if (dladdr((void*) &build_key, &info) && info.dli_fname != NULL && stat(info.dli_fname, &st) == 0) {
+    id += StringPrintf(" lib=%s size=%ld mtime=%ld", info.dli_fname, (long) st.st_size, (long) st.st_mtime);
+  }
+
+  key = fnv_hash(14695981039346656037ULL, id.data(), id.size());
+  return key;
+}
+
+// Interpreter flags which change what constant folding may do: -Qwarn and -3
+// keep operations that would warn from being folded.  They are read on every
+// lookup, since they're plain globals that embedders may set at any time.
+static uint64_t flags_key(uint64_t h) {
+  int flags[2] = { Py_DivisionWarningFlag, Py_Py3kWarningFlag };
+  return fnv_hash(h, (const char*) flags, sizeof(flags));
+}
+
+// The optimization switches read by optimize(); they change the generated
+// code, so code compiled with any of them set isn't cached.
+static const char* kCompileSwitches[] = {
+  "DISABLE_OPT", "DISABLE_COPY", "DISABLE_STORE", "DISABLE_SPECIALIZATION", "DISABLE_METHOD_CALLS",
+  "DISABLE_FUSE_FOR_ITER", "DISABLE_ESCAPE", "DISABLE_CONSTANT_FOLDING", "DISABLE_GVN",
+  "DISABLE_REGISTER_ALLOCATION", NULL
+};
+
+// The cache directory, or NULL if the cache is disabled.
+static const char* cache_dir() {
+  const char* dir = getenv("FALCON_CACHE_DIR");
+  if (dir == NULL || *dir == '\0') {
+    return NULL;
+  }
+
+  for (const char** s = kCompileSwitches; *s != NULL; ++s) {
+    if (getenv(*s)) {
+      return NULL;
+    }
+  }
+  return dir;
+}
+
+// Hash everything in the code object which affects the compiled output.
+// Returns false if the code object can't be marshalled.
+static bool code_key(PyCodeObject* code, uint64_t* key) {
+  PyObject* t = Py_BuildValue("(OOOOOOiii)", code->co_code, code->co_consts, code->co_names, code->co_varnames,
+                              code->co_freevars, code->co_cellvars, code->co_argcount, code->co_nlocals,
+                              code->co_flags);
+  if (t == NULL) {
+    PyErr_Clear();
+    return false;
+  }
+
+  PyObject* data = PyMarshal_WriteObjectToString(t, Py_MARSHAL_VERSION);
+  Py_DECREF(t);
+  if (data == NULL) {
+    PyErr_Clear();
+    return false;
+  }
+
+  uint64_t k = flags_key(build_key());
+  *key = fnv_hash(k, PyString_AS_STRING(data), PyString_GET_SIZE(data));
+  Py_DECREF(data);
+  return true;
+}
+
+// The file may be truncated or corrupt, so every size is checked against the
+// space left in the file before anything is summed or offset by it.
+static bool header_valid(const CachedCodeHeader* h, uint64_t key, size_t size, PyCodeObject* code) {
+  if (memcmp(h->magic, kCacheMagic, sizeof(kCacheMagic)) != 0 || h->format != kCacheFormat || h->key != key) {
+    return false;
+  }
+  if (h->num_registers < 0 || h->num_cells < 0 || h->num_handlers < 0
+      || h->num_freevars != PyTuple_GET_SIZE(code->co_freevars)
+      || h->num_cellvars != PyTuple_GET_SIZE(code->co_cellvars)) {
+    return false;
+  }
+
+  size_t left = size - sizeof(CachedCodeHeader);
+  if (h->instructions_size > left) {
+    return false;
+  }
+  left -= h->instructions_size;
+  if ((size_t) h->num_handlers > left / sizeof(ExceptionHandler)) {
+    return false;
+  }
+  left -= h->num_handlers * sizeof(ExceptionHandler);
+  return h->consts_size == left;
+}
+
+static std::string cache_path(const char* dir, uint64_t key) {
+  return StringPrintf("%s/%016lx.rcode", dir, (unsigned long) key);
+}
+
+RegisterCode* load_register_code(PyCodeObject* code) {
+  const char* dir = cache_dir();
+  uint64_t key;
+  if (dir == NULL || !code_key(code, &key)) {
+    return NULL;
+  }
+
+  std::string path = cache_path(dir, key);
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(CachedCodeHeader)) {
+    close(fd);
+    return NULL;
+  }
+
+  void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    Log_Perror("Failed to map %s", path.c_str());
+    return NULL;
+  }
+
+  const CachedCodeHeader* h = (const CachedCodeHeader*) data;
+  PyObject* consts = NULL;
+  const char* handlers = NULL;
+  if (header_valid(h, key, st.st_size, code)) {
+    handlers = (const char*) (h + 1) + h->instructions_size;
+    const char* folded = handlers + h->num_handlers * sizeof(ExceptionHandler);
+    if (h->consts_size == 0) {
+      consts = code->co_consts;
+      Py_INCREF(consts);
+    } else {
+      PyObject* extra = PyMarshal_ReadObjectFromString((char*) folded, h->consts_size);
+      if (extra != NULL && PyTuple_CheckExact(extra)) {
+        consts = PySequence_Concat(code->co_consts, extra);
+      }
+      Py_XDECREF(extra);
+      PyErr_Clear();
+    }
+  }
+
+  RegisterCode* regcode = NULL;
+  if (consts != NULL) {
+    regcode = new RegisterCode;
+    regcode->instructions.assign((const char*) (h + 1), h->instructions_size);
+    // The handler table isn't necessarily aligned.
+    regcode->handlers.resize(h->num_handlers);
+    memcpy(regcode->handlers.data(), handlers, h->num_handlers * sizeof(ExceptionHandler));
+    regcode->code_ = (PyObject*) code;
+    regcode->version = 1;
+    regcode->mapped_registers = 0;
+    regcode->mapped_labels = 0;
+    regcode->num_registers = h->num_registers;
+    regcode->num_freevars = h->num_freevars;
+    regcode->num_cellvars = h->num_cellvars;
+    regcode->num_cells = h->num_cells;
+    regcode->num_attr_caches = h->num_attr_caches;
+    regcode->num_global_caches = h->num_global_caches;
+    regcode->num_call_caches = h->num_call_caches;
+    regcode->alloc_caches();
+    regcode->init_frame_template(consts);
+    Py_DECREF(consts);
+
+    Log_Info("LOADED %s, %d registers from %s.", PyString_AsString(code->co_name), regcode->num_registers,
+             path.c_str());
+  }
+
+  munmap(data, st.st_size);
+  return regcode;
+}
+
+void save_register_code(PyCodeObject* code, const RegisterCode* regcode) {
+  const char* dir = cache_dir();
+  uint64_t key;
+  if (dir == NULL || !code_key(code, &key)) {
+    return;
+  }
+
+  // The folded constants are stored; the rest come from the code object.
+  PyObject* consts = regcode->consts();
+  Py_ssize_t num_folded = PyTuple_GET_SIZE(consts) - PyTuple_GET_SIZE(code->co_consts);
+  PyObject* folded = NULL;
+  if (num_folded > 0) {
+    PyObject* extra = PyTuple_GetSlice(consts, PyTuple_GET_SIZE(code->co_consts), PyTuple_GET_SIZE(consts));
+    folded = extra == NULL ? NULL : PyMarshal_WriteObjectToString(extra, Py_MARSHAL_VERSION);
+    Py_XDECREF(extra);
+    if (folded == NULL) {
+      PyErr_Clear();
+      return;
+    }
+  }
+
+  mkdir(dir, 0755);
+
+  CachedCodeHeader h;
+  bzero(&h, sizeof(h));
+  memcpy(h.magic, kCacheMagic, sizeof(kCacheMagic));
+  h.format = kCacheFormat;
+  h.key = key;
+  h.num_registers = regcode->num_registers;
+  h.num_freevars = regcode->num_freevars;
+  h.num_cellvars = regcode->num_cellvars;
+  h.num_cells = regcode->num_cells;
+  h.num_attr_caches = regcode->num_attr_caches;
+  h.num_global_caches = regcode->num_global_caches;
+  h.num_call_caches = regcode->num_call_caches;
+  h.num_handlers = regcode->handlers.size();
+  h.instructions_size = regcode->instructions.size();
+  h.consts_size = folded == NULL ? 0 : PyString_GET_SIZE(folded);
+
+  // Write to a private file and rename it into place, so concurrent
+  // processes never see a partial entry.
+  std::string path = cache_path(dir, key);
+  std::string tmp = StringPrintf("%s.%d", path.c_str(), getpid());
+  FILE* f = fopen(tmp.c_str(), "wb");
+  if (f == NULL) {
+    Log_Perror("Failed to write %s", tmp.c_str());
+    Py_XDECREF(folded);
+    return;
+  }
+
+  bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+  ok &= fwrite(regcode->instructions.data(), 1, h.instructions_size, f) == h.instructions_size;
+  ok &= fwrite(regcode->handlers.data(), sizeof(ExceptionHandler), h.num_handlers, f) == (size_t) h.num_handlers;
+  if (folded != NULL) {
+    ok &= fwrite(PyString_AS_STRING(folded), 1, h.consts_size, f) == h.consts_size;
+    Py_DECREF(folded);
+  }
+  ok &= fclose(f) == 0;
+  if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+    Log_Perror("Failed to write %s", path.c_str());
+    unlink(tmp.c_str());
+  }
+}
@@ -0,0 +1,20 @@
+#ifndef RCACHE_H_
+#define RCACHE_H_
+
+#include "Python.h"
+#include "code.h"
+
+struct RegisterCode;
+
+// A persistent cache of compiled register code, so restarted processes don't
+// need to recompile every function.  Entries are files in the directory
+// named by FALCON_CACHE_DIR (the cache is disabled if it isn't set), keyed by
+// a hash of the code object and the Falcon build that produced them.
+
+// Returns NULL if there is no usable cache entry for this code object.
+RegisterCode* load_register_code(PyCodeObject* code);
+
+// Failures to write the cache are logged and otherwise ignored.
+void save_register_code(PyCodeObject* code, const RegisterCode* regcode);
+
+#endif /* RCACHE_H_ */
@@ -11,6 +11,7 @@
 #include "opcode.h"
 
 #include "rcompile.h"
+#include "rcache.h"
 #include "reval.h"
 #include "util.h"
 
@@ -52,8 +53,10 @@ struct RCompilerUtil {
         return sizeof(BranchOp<0> );
       } else if (n_regs == 1) {
         return sizeof(BranchOp<1> );
-      } else {
+      } else if (n_regs == 2) {
         return sizeof(BranchOp<2> );
+      } else {
+        return sizeof(BranchOp<3> );
       }
     } else if (op->regs.size() == 0) {
       return sizeof(RegOp<0> );
@@ -71,7 +74,7 @@ struct RCompilerUtil {
   }
 
   // Lower an operation from compilerop to instruction stream form.
-  static void lower_op(char* dst, CompilerOp* src) {
+  static void lower_op(char* dst, CompilerOp* src, HintOffset hint_pos) {
     OpHeader* header = (OpHeader*) dst;
     header->code = src->code;
     header->arg = src->arg;
@@ -86,10 +89,19 @@ struct RCompilerUtil {
         Reg_AssertEq(op->reg[i], src->regs[i]);
       }
       Reg_AssertEq(op->num_registers, src->regs.size());
+#if GETATTR_HINTS
+      op->hint_pos = hint_pos;
+#endif
     } else if (OpUtil::is_branch(src->code)) {
       int n_regs = src->regs.size();
-      Reg_AssertLe(n_regs, 2);
-      if (n_regs == 2) {
+      Reg_AssertLe(n_regs, 3);
+      if (n_regs == 3) {
+        BranchOp<3>* op = (BranchOp<3>*) dst;
+        op->reg[0] = src->regs[0];
+        op->reg[1] = src->regs[1];
+        op->reg[2] = src->regs[2];
+        op->label = 0;
+      } else if (n_regs == 2) {
         BranchOp<2>* op = (BranchOp<2>*) dst;
         op->reg[0] = src->regs[0];
         op->reg[1] = src->regs[1];
@@ -110,7 +122,7 @@ struct RCompilerUtil {
         op->reg[i] = src->regs[i];
       }
 #if GETATTR_HINTS
-      op->hint_pos = kInvalidHint;
+      op->hint_pos = hint_pos;
 #endif
     }
 
@@ -169,6 +181,45 @@ BasicBlock* jump_prelude(CompilerState* state, RegisterStack *stack, int offset,
   }
 
 }
+// Leaving a try block with return, break or continue runs its finally block
+// in CPython.  We don't support that yet.
+static void check_no_finally(const Frame& f, int opcode) {
+  if (f.type == SETUP_FINALLY) {
+    throw RException(PyExc_SyntaxError, "Unsupported opcode %s in a try/finally block", OpUtil::name(opcode));
+  }
+}
+
+// The register of the None constant.
+static int none_register(CompilerState* state) {
+  for (int i = 0; i < state->num_consts; ++i) {
+    if (PyTuple_GET_ITEM(state->consts_tuple, i) == Py_None) {
+      return i;
+    }
+  }
+  throw RException(PyExc_SystemError, "No None constant for a finally block.");
+}
+
+/*
+ * Exception handlers start with a LOAD_EXCEPTION landing block.  The
+ * evaluator jumps there with the exception set, and LOAD_EXCEPTION stores it
+ * into the registers CPython would push: the handler's entry stack is the
+ * stack at the try block's setup plus traceback, value and type.
+ */
+void Compiler::exception_handler(CompilerState* state, RegisterStack* stack, int target, bool is_except) {
+  BasicBlock* landing = state->alloc_bb(-target, stack);
+  int tb = stack->push_register(state->num_reg++);
+  int value = stack->push_register(state->num_reg++);
+  int type = stack->push_register(state->num_reg++);
+  landing->add_op(LOAD_EXCEPTION, is_except, type, value, tb);
+
+  BasicBlock* handler = registerize(state, stack, target);
+  if (handler->idx != landing->idx + 1) {
+    landing->add_op(JUMP_ABSOLUTE, 0);
+  }
+  landing->exits.push_back(handler);
+  state->handlers[target] = landing;
+}
+
 BasicBlock* Compiler::registerize(CompilerState* state, RegisterStack *stack, int offset) {
   Py_ssize_t r;
   int oparg = 0;
@@ -472,7 +523,7 @@ BasicBlock* Compiler::registerize(CompilerState* state, RegisterStack *stack, in
       CompilerOp* f = bb->add_varargs_op(opcode, oparg, n + 3);
       // pop off the varargs tuple, the actual args, and the function
       stack->fill_register_array(f->regs, n + 2);
-      f->regs[n + 1] = stack->push_register(state->num_reg++);
+      f->regs[n + 2] = stack->push_register(state->num_reg++);
       Reg_AssertEq(f->arg, oparg);
       break;
     }
@@ -606,56 +657,84 @@ BasicBlock* Compiler::registerize(CompilerState* state, RegisterStack *stack, in
       break;
     }
     case UNPACK_SEQUENCE: {
-      int seq = stack->pop_register();
-
+      // The items are pushed last first, so item 0 ends up on top.
+      CompilerOp* f = bb->add_varargs_op(opcode, oparg, oparg + 1);
+      f->regs[0] = stack->pop_register();
       for (r = oparg; r >= 1; --r) {
-        int elt = stack->push_register(state->num_reg++);
-        bb->add_dest_op(CONST_INDEX, r - 1, seq, elt);
+        f->regs[r] = stack->push_register(state->num_reg++);
       }
+      f->num_dests = oparg;
       break;
     }
     case SETUP_LOOP: {
-      stack->push_frame(offset + CODESIZE(state->py_codestr[offset]) + oparg);
+      stack->push_frame(opcode, offset + CODESIZE(opcode) + oparg);
       break;
     }
+    case SETUP_EXCEPT: {
+      // The body falls through from here; the handler is only entered by
+      // the evaluator, so it is generated last.
+      int target = offset + CODESIZE(opcode) + oparg;
+      RegisterStack handler_stack(*stack);
+      stack->push_frame(opcode, target);
+      bb->exits.push_back(registerize(state, stack, offset + CODESIZE(opcode)));
+      exception_handler(state, &handler_stack, target, true);
+      return entry_point;
+    }
+    case SETUP_FINALLY: {
+      // Generate the finally block first, so the normal exit from the body
+      // joins the registers the exceptional entry left on the stack.
+      int target = offset + CODESIZE(opcode) + oparg;
+      RegisterStack handler_stack(*stack);
+      exception_handler(state, &handler_stack, target, false);
+      stack->push_frame(opcode, target);
+      bb->add_op(JUMP_ABSOLUTE, 0);
+      bb->exits.push_back(registerize(state, stack, offset + CODESIZE(opcode)));
+      return entry_point;
+    }
     case POP_BLOCK: {
-      stack->pop_frame();
-      // bb->add_op(opcode, oparg);
+      Frame f = stack->pop_frame();
+      if (f.type == SETUP_FINALLY) {
+        // CPython enters the finally block with just None on the stack when
+        // no exception was raised; pad that to the (type, value, traceback)
+        // of the exceptional entry.  END_FINALLY only looks at the type.
+        int none = none_register(state);
+        stack->push_register(none);
+        stack->push_register(none);
+      }
+      break;
+    }
+    case END_FINALLY: {
+      int type = stack->pop_register();
+      int value = stack->pop_register();
+      int tb = stack->pop_register();
+      bb->add_op(opcode, 0, type, value, tb);
       break;
     }
     case RAISE_VARARGS: {
-      int r1, r2, r3;
-      r1 = r2 = r3 = -1;
-      CompilerOp* op = bb->add_varargs_op(opcode, 0, oparg);
-      if (oparg == 3) {
-        r1 = stack->pop_register();
-        r2 = stack->pop_register();
-        r3 = stack->pop_register();
-        op->regs.push_back(r1);
-        op->regs.push_back(r2);
-        op->regs.push_back(r3);
-      } else if (oparg == 2) {
-        r1 = stack->pop_register();
-        r2 = stack->pop_register();
-        op->regs.push_back(r1);
-        op->regs.push_back(r2);
-      } else if (oparg == 1) {
-        r1 = stack->pop_register();
-        op->regs.push_back(r1);
+      // Registers are (type, value, traceback); missing ones are invalid.
+      int regs[3] = { -1, -1, -1 };
+      for (r = oparg - 1; r >= 0; --r) {
+        regs[r] = stack->pop_register();
       }
-
-      break;
+      bb->add_op(opcode, oparg, regs[0], regs[1], regs[2]);
+      return entry_point;
     }
       // Control flow instructions - recurse down each branch with a copy of the current stack.
     case BREAK_LOOP: {
       Frame f = stack->pop_frame();
+      while (f.type != SETUP_LOOP) {
+        check_no_finally(f, opcode);
+        f = stack->pop_frame();
+      }
 
       bb->add_op(opcode, 0);
       bb->exits.push_back(registerize(state, stack, f.target));
       return entry_point;
     }
     case CONTINUE_LOOP: {
-      stack->pop_frame();
+      while (stack->frames.back().type != SETUP_LOOP) {
+        check_no_finally(stack->pop_frame(), opcode);
+      }
       bb->add_op(opcode, oparg);
       bb->exits.push_back(registerize(state, stack, oparg));
       return entry_point;
@@ -678,10 +757,19 @@ BasicBlock* Compiler::registerize(CompilerState* state, RegisterStack *stack, in
     }
     case JUMP_IF_FALSE_OR_POP:
     case JUMP_IF_TRUE_OR_POP: {
-      RegisterStack a(*stack);
       int r1 = stack->pop_register();
       RegisterStack b(*stack);
       bb->add_op(opcode, oparg, r1);
+      // The value stays on the stack when jumping, so where the paths merge
+      // the other path's value is moved into its register; keep that from
+      // overwriting a constant or local.
+      if (r1 < state->num_consts + state->num_locals) {
+        int r2 = state->num_reg++;
+        bb->add_dest_op(LOAD_FAST, 0, r1, r2);
+        r1 = r2;
+      }
+      RegisterStack a(*stack);
+      a.push_register(r1);
 
       BasicBlock* right = registerize(state, &a, oparg);
       BasicBlock* left = registerize(state, &b, offset + CODESIZE(opcode));
@@ -716,15 +804,21 @@ BasicBlock* Compiler::registerize(CompilerState* state, RegisterStack *stack, in
       return entry_point;
     }
     case RETURN_VALUE: {
+      for (size_t i = 0; i < stack->frames.size(); ++i) {
+        check_no_finally(stack->frames[i], opcode);
+      }
       int r1 = stack->pop_register();
       bb->add_op(opcode, 0, r1);
       return entry_point;
     }
 
-    case SETUP_EXCEPT:
-    case SETUP_FINALLY:
-    case END_FINALLY:
-    case YIELD_VALUE:
+    case YIELD_VALUE: {
+      // The result is the value sent into the generator when it resumes.
+      int r1 = stack->pop_register();
+      int r2 = stack->push_register(state->num_reg++);
+      bb->add_dest_op(opcode, oparg, r1, r2);
+      break;
+    }
     default:
       throw RException(PyExc_SyntaxError, "Unsupported opcode %s, arg = %d", OpUtil::name(opcode), oparg);
       break;
@@ -733,7 +827,24 @@ BasicBlock* Compiler::registerize(CompilerState* state, RegisterStack *stack, in
   return entry_point;
 }
 
-void lower_register_code(CompilerState* state, std::string *out) {
+// The conditional branch taken when op isn't.  Conditional branches don't
+// pop in the register VM, so the *_OR_POP forms pair up like the others.
+static int negate_branch(int op) {
+  switch (op) {
+  case POP_JUMP_IF_FALSE:
+    return POP_JUMP_IF_TRUE;
+  case POP_JUMP_IF_TRUE:
+    return POP_JUMP_IF_FALSE;
+  case JUMP_IF_FALSE_OR_POP:
+    return JUMP_IF_TRUE_OR_POP;
+  case JUMP_IF_TRUE_OR_POP:
+    return JUMP_IF_FALSE_OR_POP;
+  default:
+    throw RException(PyExc_SystemError, "Branch %s doesn't fall through to its first exit", OpUtil::name(op));
+  }
+}
+
+void lower_register_code(CompilerState* state, std::string *out, std::vector<ExceptionHandler>* handlers) {
 
 // first, dump all of the operations to the output buffer and record
 // their positions.
@@ -745,13 +856,41 @@ void lower_register_code(CompilerState* state, std::string *out) {
       CompilerOp* c = bb->code[j];
       assert(!c->dead);
 
+      HintOffset hint_pos = kInvalidHint;
+      if (OpUtil::has_hint(c->code)) {
+        int& num_caches = c->code == LOAD_GLOBAL ? state->num_global_caches :
+                          OpUtil::is_call(c->code) ? state->num_call_caches : state->num_attr_caches;
+        Reg_AssertLt(num_caches, (int)kInvalidHint);
+        hint_pos = num_caches++;
+      }
+
       size_t offset = out->size();
       out->resize(out->size() + RCompilerUtil::op_size(c));
-      RCompilerUtil::lower_op(&(*out)[0] + offset, c);
+      RCompilerUtil::lower_op(&(*out)[0] + offset, c, hint_pos);
       Log_Debug("Wrote op at offset %d, size: %d, %s", offset, RCompilerUtil::op_size(c), c->str().c_str());
     }
   }
 
+// the handler table: one range per run of blocks with the same handler.
+  BasicBlock* last_handler = NULL;
+  for (size_t i = 0; i < state->bbs.size(); ++i) {
+    BasicBlock* bb = state->bbs[i];
+    int end = i + 1 < state->bbs.size() ? state->bbs[i + 1]->reg_offset : out->size();
+    if (bb->handler == NULL || bb->reg_offset == end) {
+      continue;
+    }
+    if (bb->handler == last_handler && handlers->back().end == bb->reg_offset) {
+      handlers->back().end = end;
+      continue;
+    }
+    ExceptionHandler h;
+    h.start = bb->reg_offset;
+    h.end = end;
+    h.handler = bb->handler->reg_offset;
+    handlers->push_back(h);
+    last_handler = bb->handler;
+  }
+
 // now patchup labels in the emitted code to point to the correct
 // locations.
   int pos = 0;
@@ -779,7 +918,9 @@ void lower_register_code(CompilerState* state, std::string *out) {
       pos += RCompilerUtil::op_size(bb->code[j]);
     }
 
-    Reg_Assert(op->code == RETURN_VALUE || OpUtil::is_branch(op->code) || (bb->exits[0] == state->bbs[i + 1]),
+    Reg_Assert(op->code == RETURN_VALUE || op->code == RETURN_VALUES || op->code == RAISE_VARARGS
+               || OpUtil::is_branch(op->code)
+               || (bb->exits[0] == state->bbs[i + 1]),
                "Non-local jump from non-branch op %s", OpUtil::name(op->code));
 
     if (OpUtil::is_branch(op->code) && op->code != RETURN_VALUE) {
@@ -787,7 +928,7 @@ void lower_register_code(CompilerState* state, std::string *out) {
       if (bb->exits.size() == 1) {
         BasicBlock& jmp = *bb->exits[0];
         ((BranchOp<0>*) op)->label = jmp.reg_offset;
-        Reg_AssertGt(jmp.reg_offset, 0);
+        Reg_AssertGe(jmp.reg_offset, 0);
         Reg_AssertEq(((BranchOp<0>*)op)->label, jmp.reg_offset);
       } else {
         // One exit is the fall-through to the next block.
@@ -798,7 +939,12 @@ void lower_register_code(CompilerState* state, std::string *out) {
                    a.idx, b.idx, fallthrough.idx);
         BasicBlock& jmp = (a.idx == fallthrough.idx) ? b : a;
 //        Log_Info("%d, %d", a.idx, b.idx);
-        Reg_AssertGt(jmp.reg_offset, 0);
+        if (a.idx != fallthrough.idx) {
+          // The branch target (exits[1]) was laid out after us, so branch
+          // to the other exit on the opposite condition instead.
+          op->code = negate_branch(op->code);
+        }
+        Reg_AssertGe(jmp.reg_offset, 0);
         ((BranchOp<0>*) op)->label = jmp.reg_offset;
         Reg_AssertEq(((BranchOp<0>*)op)->label, jmp.reg_offset);
       }
@@ -808,40 +954,23 @@ void lower_register_code(CompilerState* state, std::string *out) {
 
 #include "optimizations.h"
 
-RegisterCode* Compiler::compile_(PyObject* func) {
-  PyCodeObject* code = NULL;
-  if (PyFunction_Check(func)) {
-    code = (PyCodeObject*) PyFunction_GET_CODE(func);
-  } else if (PyCode_Check(func)) {
-    code = (PyCodeObject*) func;
-  } else {
-    throw RException(PyExc_SystemError, "Not a function: %s", obj_to_str(func));
-  }
-
-  if (!code) {
-    throw RException(PyExc_SystemError, "No code in function object.");
-  }
-
+RegisterCode* Compiler::compile_(PyCodeObject* code) {
   CompilerState state(code);
   RegisterStack stack;
 
   BasicBlock* entry_point = registerize(&state, &stack, 0);
   if (entry_point == NULL) {
-    throw RException(PyExc_SystemError, "Failed to registerize %s", PyEval_GetFuncName(func));
+    throw RException(PyExc_SystemError, "Failed to registerize %s", PyString_AsString(code->co_name));
   }
+  state.link_handlers();
 
   optimize(&state);
   RegisterCode *regcode = new RegisterCode;
 
-  lower_register_code(&state, &regcode->instructions);
+  lower_register_code(&state, &regcode->instructions, &regcode->handlers);
 
   regcode->code_ = (PyObject*) code;
   regcode->version = 1;
-  if (PyFunction_Check(func)) {
-    regcode->function = func;
-  } else {
-    regcode->function = NULL;
-  }
   regcode->mapped_registers = 0;
   regcode->mapped_labels = 0;
   regcode->num_registers = state.num_reg;
@@ -850,10 +979,143 @@ RegisterCode* Compiler::compile_(PyObject* func) {
   regcode->num_cellvars = PyTuple_GET_SIZE(code->co_cellvars);
   regcode->num_cells = regcode->num_freevars + regcode->num_cellvars;
 
+  regcode->num_attr_caches = state.num_attr_caches;
+  regcode->num_global_caches = state.num_global_caches;
+  regcode->num_call_caches = state.num_call_caches;
+  regcode->alloc_caches();
+  regcode->init_frame_template(state.consts_tuple);
+
   Log_Info(
       "COMPILED %s, %d registers, %d operations, %d stack ops.",
-      PyEval_GetFuncName(func), regcode->num_registers, state.num_ops(), num_python_ops(PyString_AsString(code->co_code), PyString_GET_SIZE(code->co_code)));
+      PyString_AsString(code->co_name), regcode->num_registers, state.num_ops(), num_python_ops(PyString_AsString(code->co_code), PyString_GET_SIZE(code->co_code)));
 
   return regcode;
 }
 
+// The weak reference callback for a compiled code object; self is a capsule
+// holding the compiler and the (now dead) code object address.
+struct CodeRef {
+  Compiler* compiler;
+  PyObject* code;
+};
+
+static void code_ref_free(PyObject* capsule) {
+  delete (CodeRef*) PyCapsule_GetPointer(capsule, NULL);
+}
+
+static PyObject* code_freed(PyObject* self, PyObject* weakref) {
+  CodeRef* ref = (CodeRef*) PyCapsule_GetPointer(self, NULL);
+  ref->compiler->invalidate(ref->code);
+  Py_RETURN_NONE;
+}
+
+static PyMethodDef code_freed_def = { "code_freed", code_freed, METH_O, NULL };
+
+Compiler::Compiler() {
+  cache_.set_empty_key(NULL);
+  cache_.set_deleted_key((PyObject*) -1);
+
+  epoch_ = 0;
+  disk_loads_ = 0;
+  hot_threshold_ = kDefaultHotThreshold;
+  if (getenv("FALCON_HOT_THRESHOLD")) {
+    hot_threshold_ = atoi(getenv("FALCON_HOT_THRESHOLD"));
+  }
+}
+
+int Compiler::back_edges(PyCodeObject* code) {
+  const unsigned char* codestr = (const unsigned char*) PyString_AS_STRING(code->co_code);
+  const int codelen = PyString_GET_SIZE(code->co_code);
+  int n = 0;
+  for (int i = 0; i < codelen; i += CODESIZE(codestr[i])) {
+    switch (codestr[i]) {
+    case JUMP_ABSOLUTE:
+    case CONTINUE_LOOP:
+    case POP_JUMP_IF_FALSE:
+    case POP_JUMP_IF_TRUE:
+    case JUMP_IF_FALSE_OR_POP:
+    case JUMP_IF_TRUE_OR_POP:
+      if (GETARG(codestr, i) <= i) {
+        ++n;
+      }
+      break;
+    }
+  }
+  return n;
+}
+
+Compiler::CacheEntry& Compiler::lookup(PyCodeObject* code) {
+  CodeCache::iterator i = cache_.find((PyObject*) code);
+  if (i != cache_.end()) {
+    return i->second;
+  }
+
+  CodeRef* ref = new CodeRef;
+  ref->compiler = this;
+  ref->code = (PyObject*) code;
+  PyObject* capsule = PyCapsule_New(ref, NULL, code_ref_free);
+  PyObject* callback = PyCFunction_New(&code_freed_def, capsule);
+  Py_DECREF(capsule);
+
+  CacheEntry entry;
+  entry.code = NULL;
+  entry.failed = false;
+  entry.calls = 0;
+  entry.weight = 1 + kBackEdgeWeight * back_edges(code);
+  entry.weakref = PyWeakref_NewRef((PyObject*) code, callback);
+  Py_DECREF(callback);
+  if (entry.weakref == NULL) {
+    PyErr_Clear();
+    throw RException(PyExc_SystemError, "Can't create a weak reference to %s", PyString_AsString(code->co_name));
+  }
+
+  cache_[(PyObject*) code] = entry;
+  return cache_[(PyObject*) code];
+}
+
+RegisterCode* Compiler::compile_entry(CacheEntry& entry, PyCodeObject* code) {
+  if (entry.failed) {
+    throw RException(PyExc_SystemError, "Failed to compile %s", PyString_AsString(code->co_name));
+  }
+
+  try {
+    entry.code = load_register_code(code);
+    if (entry.code == NULL) {
+      entry.code = compile_(code);
+      save_register_code(code, entry.code);
+    } else {
+      ++disk_loads_;
+    }
+    entry.code->generator = (code->co_flags & CO_GENERATOR) != 0;
+    entry.code->varargs = (code->co_flags & (CO_VARARGS | CO_VARKEYWORDS)) != 0;
+  } catch (RException& e) {
+    entry.failed = true;
+    throw e;
+  }
+  return entry.code;
+}
+
+void Compiler::invalidate(PyObject* code) {
+  CodeCache::iterator i = cache_.find(code);
+  if (i == cache_.end()) {
+    return;
+  }
+
+  CacheEntry entry = i->second;
+  cache_.erase(i);
+  // Call sites only remember code objects that were compiled or failed to
+  // compile; cold ones can die without invalidating them.
+  if (entry.code != NULL || entry.failed) {
+    ++epoch_;
+  }
+  delete entry.code;
+  Py_DECREF(entry.weakref);
+}
+
+Compiler::~Compiler() {
+  for (CodeCache::iterator i = cache_.begin(); i != cache_.end(); ++i) {
+    // Dropping the weak reference also drops its callback.
+    Py_DECREF(i->second.weakref);
+    delete i->second.code;
+  }
+}
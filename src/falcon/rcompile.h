@@ -16,41 +16,121 @@
 #include "register_stack.h"
 #include "compiler_state.h"
 
+// Functions called from compiled code are run by CPython until they have been
+// called this many times (see Compiler::compile_if_hot).  Override with FALCON_HOT_THRESHOLD.
+static const int kDefaultHotThreshold = 10;
+
+// A call to code with loops counts as this many calls per loop back-edge (on
+// top of the call itself), since it typically runs its loop body many times.
+static const int kBackEdgeWeight = 4;
+
+// Compiled code is cached per code object, so every function (or closure)
+// created from the same code shares it; globals, defaults and the closure are
+// taken from the function when a frame is created.  Each entry holds a weak
+// reference to its code object and is dropped when the code object dies.
 struct Compiler {
 private:
-  typedef google::dense_hash_map<PyObject*, RegisterCode*> CodeCache;
+  struct CacheEntry {
+    // NULL until the code is hot, or if it failed to compile.
+    RegisterCode* code;
+    PyObject* weakref;
+
+    // Calls so far, each counted as weight.
+    int calls;
+    int weight;
+    bool failed;
+  };
+
+  typedef google::dense_hash_map<PyObject*, CacheEntry> CodeCache;
   CodeCache cache_;
+  int hot_threshold_;
+
+  // Bumped whenever a compiled (or failed) code object dies, so holders of
+  // borrowed code object pointers can tell that the address may have been
+  // reused.
+  unsigned long epoch_;
+
+  // Code loaded from the on-disk cache rather than compiled.
+  long disk_loads_;
+
   BasicBlock* registerize(CompilerState* state, RegisterStack *stack, int offset);
-  RegisterCode* compile_(PyObject* function);
+  void exception_handler(CompilerState* state, RegisterStack* stack, int target, bool is_except);
+  RegisterCode* compile_(PyCodeObject* code);
+  CacheEntry& lookup(PyCodeObject* code);
+  RegisterCode* compile_entry(CacheEntry& entry, PyCodeObject* code);
+
+  static inline PyCodeObject* code_for(PyObject* func);
+  static int back_edges(PyCodeObject* code);
 public:
-  Compiler() {
-    cache_.set_empty_key(NULL);
-  }
+  Compiler();
+  ~Compiler();
 
+  // Compile (or fetch the cached code for) a function or code object.
   inline RegisterCode* compile(PyObject* function);
+
+  // As compile, but returns NULL if the function hasn't been called often
+  // enough to be worth compiling yet.  A running CPython frame can't be moved
+  // over later, so calls to code with loops are weighted by its back-edges.
+  inline RegisterCode* compile_if_hot(PyObject* function);
+
+  // Whether the function's code has been compiled.
+  inline bool is_compiled(PyObject* function);
+
+  void set_hot_threshold(int threshold) {
+    hot_threshold_ = threshold;
+  }
+
+  // Called when a code object we compiled is freed.
+  void invalidate(PyObject* code);
+
+  unsigned long epoch() const {
+    return epoch_;
+  }
+
+  long disk_loads() const {
+    return disk_loads_;
+  }
 };
 
-RegisterCode* Compiler::compile(PyObject* func) {
+PyCodeObject* Compiler::code_for(PyObject* func) {
   if (PyMethod_Check(func)) {
     func = PyMethod_GET_FUNCTION(func);
   }
 
-  CodeCache::iterator i = cache_.find(func);
+  if (PyFunction_Check(func)) {
+    return (PyCodeObject*) PyFunction_GET_CODE(func);
+  } else if (PyCode_Check(func)) {
+    return (PyCodeObject*) func;
+  }
+  throw RException(PyExc_SystemError, "Not a function: %s", obj_to_str(func));
+}
 
-  if (i != cache_.end()) {
-    return i->second;
+RegisterCode* Compiler::compile(PyObject* func) {
+  PyCodeObject* code = code_for(func);
+  CodeCache::iterator i = cache_.find((PyObject*) code);
+  if (i != cache_.end() && i->second.code != NULL) {
+    return i->second.code;
   }
+  return compile_entry(lookup(code), code);
+}
 
+RegisterCode* Compiler::compile_if_hot(PyObject* func) {
+  PyCodeObject* code = code_for(func);
+  CodeCache::iterator i = cache_.find((PyObject*) code);
+  if (i != cache_.end() && i->second.code != NULL) {
+    return i->second.code;
+  }
 
-  try {
-    RegisterCode* code = compile_(func);
-    cache_[func] = code;
-  } catch (RException& e) {
-    cache_[func] = NULL;
-    throw e;
+  CacheEntry& entry = i != cache_.end() ? i->second : lookup(code);
+  if (!entry.failed && (entry.calls += entry.weight) < hot_threshold_) {
+    return NULL;
   }
+  return compile_entry(entry, code);
+}
 
-  return cache_[func];
+bool Compiler::is_compiled(PyObject* func) {
+  CodeCache::iterator i = cache_.find((PyObject*) code_for(func));
+  return i != cache_.end() && i->second.code != NULL;
 }
 
 #endif /* RCOMPILE_H_ */
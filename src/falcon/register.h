@@ -9,15 +9,24 @@
 
 static const int ObjType = 0;
 static const int IntType = 1;
+static const int FloatType = 2;
+static const int BoolType = 6;
 
 #if USED_TYPED_REGISTERS
 
-#define TYPE_MASK 0x1
+// The low bits of a register give its type: objects are aligned pointers
+// (000), ints are shifted left over a set low bit (xx1), floats are tagged
+// 010 and bools 110, with the value in the bit above.  Floats only have 61
+// bits to themselves, so just those with a binary exponent within +-128 are
+// unboxed; others (including zero) stay objects.
+#define TYPE_MASK 0x7
+
+// The biased exponent of the smallest unboxed float.
+static const uint64_t kFloatExpBase = 1023 - 128;
 
 struct Register {
   union {
     int64_t i_value;
-    double f_value;
     PyObject* objval;
   };
 
@@ -29,9 +38,8 @@ struct Register {
     store(v);
   }
 
-  Register(const Register& r) {
-    objval = r.objval;
-  }
+  // Trivially copyable, so frame setup can memcpy whole register segments.
+  Register(const Register& r) = default;
 
   operator long() {
     return as_int();
@@ -59,13 +67,40 @@ struct Register {
     return i_value >> 1;
   }
 
+  // The double is stored rotated left by one, so the sign is the low bit,
+  // with the exponent rebased to the unboxed range and shifted over the tag.
+  f_inline double as_float() const {
+    uint64_t rot = ((uint64_t) i_value >> 3) + (kFloatExpBase << 53);
+    uint64_t bits = (rot >> 1) | (rot << 63);
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return d;
+  }
+
+  f_inline bool as_bool() const {
+    return (i_value >> 3) & 1;
+  }
+
+  // Tagged values are boxed in place, so a register escaping repeatedly
+  // is only boxed once; the register owns the box like any other object.
+  // Copies of a register made while it was still tagged are boxed
+  // separately, so two variables bound to the same large int may not be
+  // the same object (`is` on such ints isn't guaranteed by Python either).
   f_inline PyObject*& as_obj() {
-    if (get_type() == ObjType) {
+    int type = get_type();
+    if (type == ObjType) {
       return objval;
-    } else {
+    } else if (type == IntType) {
       objval = PyInt_FromLong(as_int());
 //      Log_Info("Coerced: %p %d", thiss, objval->ob_refcnt);
       return objval;
+    } else if (type == FloatType) {
+      objval = PyFloat_FromDouble(as_float());
+      return objval;
+    } else {
+      objval = as_bool() ? Py_True : Py_False;
+      Py_INCREF(objval);
+      return objval;
     }
   }
 
@@ -73,8 +108,17 @@ struct Register {
     objval = (PyObject*) NULL;
   }
 
+  f_inline bool empty() const {
+    return objval == NULL;
+  }
+
+  // The object held by the register, or NULL if it holds an unboxed value.
+  f_inline PyObject* boxed() const {
+    return get_type() == ObjType ? objval : NULL;
+  }
+
   f_inline int get_type() const {
-    return (i_value & TYPE_MASK);
+    return (i_value & IntType) ? IntType : (i_value & TYPE_MASK);
   }
 
   f_inline void decref() {
@@ -99,21 +143,53 @@ struct Register {
     store((long) v);
   }
 
+  // Whether v fits in the 63 bits of a tagged int.
+  static f_inline bool is_tagged_int(long v) {
+    return ((v << 1) >> 1) == v;
+  }
+
   f_inline void store(long v) {
 //    Log_Info("store: %p : %d", this, v);
+    if (!is_tagged_int(v)) {
+      objval = PyInt_FromLong(v);
+      return;
+    }
     i_value = v << 1;
     i_value |= IntType;
   }
 
+  // Returns false, leaving the register unchanged, if d can't be unboxed.
+  f_inline bool store_float(double d) {
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    if (((bits >> 52) & 0x7ff) - kFloatExpBase >= 256) {
+      return false;
+    }
+    uint64_t rot = (bits << 1) | (bits >> 63);
+    i_value = (int64_t) (((rot - (kFloatExpBase << 53)) << 3) | FloatType);
+    return true;
+  }
+
+  f_inline void store_bool(bool b) {
+    i_value = ((int64_t) b << 3) | BoolType;
+  }
+
+  // Takes ownership of obj; ints and bools are stored tagged.
   f_inline void store(PyObject* obj) {
-    if (obj == NULL || !PyInt_CheckExact(obj)) {
-      // Type flag is implicitly set to zero as a result of pointer alignment.
-      objval = obj;
-    } else {
-      store(PyInt_AS_LONG(obj) );
+    if (obj != NULL && PyInt_CheckExact(obj)) {
+      long v = ((PyIntObject*) obj)->ob_ival;
+      if (is_tagged_int(v)) {
+        store(v);
+        Py_DECREF(obj);
+        return;
+      }
+    } else if (obj == Py_True || obj == Py_False) {
+      store_bool(obj == Py_True);
       Py_DECREF(obj);
-//      Log_Info("%d %d", as_int(), obj->ob_refcnt);
+      return;
     }
+    // Type flag is implicitly set to zero as a result of pointer alignment.
+    objval = obj;
   }
 };
 
@@ -155,6 +231,14 @@ struct Register {
   f_inline void reset() {
     v = (PyObject*) NULL;
   }
+
+  f_inline bool empty() const {
+    return v == NULL;
+  }
+
+  f_inline PyObject* boxed() const {
+    return v;
+  }
   f_inline void store(PyObject* obj) {
     v = obj;
   }
@@ -170,6 +254,11 @@ struct Register {
   f_inline void store(long ival) {
     v = PyInt_FromLong(ival);
   }
+
+  f_inline void store_bool(bool b) {
+    v = b ? Py_True : Py_False;
+    Py_INCREF(v);
+  }
 };
 #endif
 
@@ -3,8 +3,9 @@
 #include "register_stack.h"
 
 
-void RegisterStack::push_frame(int target) {
+void RegisterStack::push_frame(int type, int target) {
   Frame f;
+  f.type = type;
   f.stack_pos = regs.size();
   f.target = target;
   frames.push_back(f);
@@ -18,7 +18,7 @@ struct RegisterStack {
     this->frames = other.frames;
   }
 
-  void push_frame(int target);
+  void push_frame(int type, int target);
   Frame pop_frame();
 
   int push_register(int reg);
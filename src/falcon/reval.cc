@@ -8,8 +8,12 @@
 #include <stdint.h>
 #include <stdarg.h>
 
+#include <new>
+#include <vector>
+
 #include "reval.h"
 #include "rcompile.h"
+#include "rgen.h"
 
 #ifdef FALCON_DEBUG
 static bool logging_enabled() {
@@ -36,7 +40,8 @@ static bool logging_enabled() {
 #define LOAD_INT(regnum) registers[regnum].as_int()
 #define LOAD_FLOAT(regnum) registers[regnum].as_float()
 
-typedef long (*IntegerBinaryOp)(long, long);
+typedef bool (*IntegerBinaryOp)(long, long, long*);
+typedef double (*FloatBinaryOp)(double, double);
 typedef PyObject* (*PythonBinaryOp)(PyObject*, PyObject*);
 typedef PyObject* (*UnaryFunction)(PyObject*);
 
@@ -87,127 +92,567 @@ struct PyObjHelper {
   }
 };
 
-RegisterFrame::RegisterFrame(RegisterCode* rcode, PyObject* obj, const ObjVector& args, const ObjVector& kw) :
+static inline f_inline long str_hash(PyObject* key) {
+  long hash;
+  if (!PyString_CheckExact(key) || (hash = ((PyStringObject *) key)->ob_shash) == -1) {
+    hash = PyObject_Hash(key);
+  }
+  return hash;
+}
+
+// Python 2 dictionaries have no version tag, so to cache names resolved in
+// the builtins we need to know when a module dictionary gains a key.  Every
+// insertion goes through ma_lookup, so we replace the lookup function of
+// watched dictionaries with a wrapper that notices failed lookups.  A failed
+// lookup is either a read of a missing name or the first half of an insert;
+// we remember it and check whether the key was actually added the next time
+// the epoch is consulted.  Any real insert bumps the dictionary's epoch.
+//
+// Watched dictionaries aren't kept alive, and we don't hook their
+// deallocation.  A dictionary allocated in the place of a freed one starts
+// out with the plain lookup function, so caches check that the dictionary is
+// still watched before trusting its epoch; watching it again finds the old
+// record and bumps its epoch.  Records are never freed.  The dictionary with
+// a pending miss is referenced until the miss is checked.
+typedef PyDictEntry* (*DictLookupFunc)(PyDictObject*, PyObject*, long);
+
+static DictLookupFunc lookdict_string_ = NULL;
+static DictLookupFunc lookdict_ = NULL;
+
+typedef google::dense_hash_map<PyDictObject*, DictWatch*> DictWatchMap;
+static DictWatchMap dict_watches_;
+
+static PyDictObject* pending_dict_ = NULL;
+static PyObject* pending_key_ = NULL;
+static long pending_hash_ = 0;
+
+static PyDictEntry* watched_lookdict_string(PyDictObject* mp, PyObject* key, long hash);
+static PyDictEntry* watched_lookdict(PyDictObject* mp, PyObject* key, long hash);
+
+static void dict_changed(PyDictObject* d) {
+  ++dict_watches_[d]->epoch;
+}
+
+// Releasing the dictionary may run arbitrary code, so callers must not hold
+// on to dictionary entries across this.
+static void dict_watch_flush() {
+  PyDictObject* d = pending_dict_;
+  PyObject* key = pending_key_;
+  pending_dict_ = NULL;
+  if (d->ma_lookup != &watched_lookdict_string
+      || lookdict_string_(d, key, pending_hash_)->me_value != NULL) {
+    dict_changed(d);
+  }
+  Py_DECREF(key);
+  Py_DECREF(d);
+}
+
+static PyDictEntry* watched_lookdict_string(PyDictObject* mp, PyObject* key, long hash) {
+  // The previous miss has been inserted (or not) by now.
+  if (pending_dict_ != NULL) {
+    dict_watch_flush();
+  }
+  PyDictEntry* ep = lookdict_string_(mp, key, hash);
+  if (mp->ma_lookup != &watched_lookdict_string) {
+    // lookdict_string has switched this dictionary to the generic lookup;
+    // keep watching it there.
+    mp->ma_lookup = &watched_lookdict;
+    dict_changed(mp);
+    return ep;
+  }
+  if (ep != NULL && ep->me_value == NULL) {
+    Py_INCREF(mp);
+    Py_INCREF(key);
+    pending_dict_ = mp;
+    pending_key_ = key;
+    pending_hash_ = hash;
+  }
+  return ep;
+}
+
+// Dictionaries with non-string keys may run arbitrary comparison code during a
+// lookup, so we can't safely re-check a pending key; treat every miss as an insert.
+static PyDictEntry* watched_lookdict(PyDictObject* mp, PyObject* key, long hash) {
+  PyDictEntry* ep = lookdict_(mp, key, hash);
+  if (ep == NULL || ep->me_value == NULL) {
+    dict_changed(mp);
+  }
+  return ep;
+}
+
+// Not exported by the Python headers; captured in the Evaluator constructor.
+static PyTypeObject* method_descr_type_ = NULL;
+static PyTypeObject* range_iter_type_ = NULL;
+static PyTypeObject* list_iter_type_ = NULL;
+static PyTypeObject* tuple_iter_type_ = NULL;
+
+// Layouts of the builtin iterators from rangeobject.c, listobject.c,
+// tupleobject.c and dictobject.c, which FOR_ITER steps without calling
+// tp_iternext.
+struct RangeIterObject {
+  PyObject_HEAD
+  long index;
+  long start;
+  long step;
+  long len;
+};
+
+struct ListIterObject {
+  PyObject_HEAD
+  long it_index;
+  PyListObject* it_seq;
+};
+
+struct TupleIterObject {
+  PyObject_HEAD
+  long it_index;
+  PyTupleObject* it_seq;
+};
+
+struct DictIterObject {
+  PyObject_HEAD
+  PyDictObject* di_dict;
+  Py_ssize_t di_used;
+  Py_ssize_t di_pos;
+  PyObject* di_result;
+  Py_ssize_t len;
+};
+
+static inline f_inline bool dict_is_watched(PyDictObject* d) {
+  return d->ma_lookup == &watched_lookdict_string || d->ma_lookup == &watched_lookdict;
+}
+
+static void dict_watch_init() {
+  if (lookdict_string_ != NULL) {
+    return;
+  }
+
+  // Fetch the private lookup functions by inspecting fresh dictionaries.
+  PyObject* d = PyDict_New();
+  lookdict_string_ = ((PyDictObject*) d)->ma_lookup;
+  PyObject* k = PyInt_FromLong(0);
+  PyDict_SetItem(d, k, Py_None);
+  lookdict_ = ((PyDictObject*) d)->ma_lookup;
+  Py_DECREF(k);
+  Py_DECREF(d);
+
+  dict_watches_.set_empty_key(NULL);
+}
+
+// Returns NULL if the dictionary uses a lookup function we don't know how to wrap.
+static DictWatch* dict_watch(PyDictObject* d) {
+  if (dict_is_watched(d)) {
+    return dict_watches_[d];
+  }
+  if (d->ma_lookup == lookdict_string_) {
+    d->ma_lookup = &watched_lookdict_string;
+  } else if (d->ma_lookup == lookdict_) {
+    d->ma_lookup = &watched_lookdict;
+  } else {
+    return NULL;
+  }
+
+  // The record may belong to a freed dictionary at the same address, or to
+  // this one from before it stopped being watched; either way caches taken
+  // against it are stale.
+  DictWatch*& w = dict_watches_[d];
+  if (w == NULL) {
+    w = new DictWatch;
+    w->epoch = 0;
+  } else {
+    ++w->epoch;
+  }
+  return w;
+}
+
+// May run arbitrary code (see dict_watch_flush()).
+static inline f_inline unsigned long dict_watch_epoch(DictWatch* w) {
+  if (pending_dict_ != NULL) {
+    dict_watch_flush();
+  }
+  return w->epoch;
+}
+
+// Lookup without triggering the watcher.
+static inline f_inline PyDictEntry* dict_entry(PyDictObject* d, PyObject* key) {
+  DictLookupFunc lookup = d->ma_lookup;
+  if (lookup == &watched_lookdict_string) {
+    lookup = lookdict_string_;
+  } else if (lookup == &watched_lookdict) {
+    lookup = lookdict_;
+  }
+
+  PyDictEntry* ep = lookup(d, key, str_hash(key));
+  if (ep == NULL) {
+    throw RException();
+  }
+  return ep->me_value != NULL ? ep : NULL;
+}
+
+FrameStack::FrameStack() : top_(0) {
+  Chunk c;
+  c.base = new Register[kChunkSize];
+  c.size = kChunkSize;
+  c.used = 0;
+  chunks_.push_back(c);
+}
+
+FrameStack::~FrameStack() {
+  for (size_t i = 0; i < chunks_.size(); ++i) {
+    delete[] chunks_[i].base;
+  }
+}
+
+void FrameStack::next_chunk(size_t n) {
+  ++top_;
+  if (top_ == chunks_.size()) {
+    Chunk c;
+    c.base = NULL;
+    c.size = 0;
+    chunks_.push_back(c);
+  }
+
+  Chunk& c = chunks_[top_];
+  if (c.size < n) {
+    delete[] c.base;
+    c.size = n > kChunkSize ? n : kChunkSize;
+    c.base = new Register[c.size];
+  }
+  c.used = 0;
+}
+
+// Stacks are never freed; a thread which ran Falcon code keeps its chunks.
+static __thread FrameStack* frame_stack_ = NULL;
+
+FrameStack* FrameStack::current() {
+  if (frame_stack_ == NULL) {
+    frame_stack_ = new FrameStack;
+  }
+  return frame_stack_;
+}
+
+// Resolve the builtins for code running with globals, caching them on the
+// code for as long as the globals dictionary is alive and hasn't gained a
+// key.  Globals without a usable __builtins__ get the interpreter's.
+static PyObject* frame_builtins(RegisterCode* code, PyObject* globals) {
+  if (globals == code->builtins_globals && code->builtins_watch != NULL
+      && dict_is_watched((PyDictObject*) globals) && code->builtins_epoch == dict_watch_epoch(code->builtins_watch)) {
+    return code->builtins;
+  }
+
+  static PyObject* builtins_str = PyString_InternFromString("__builtins__");
+  if (globals == NULL) {
+    return PyEval_GetBuiltins();
+  }
+  PyObject* builtins = PyDict_GetItem(globals, builtins_str);
+  if (builtins != NULL && PyModule_Check(builtins)) {
+    builtins = PyModule_GetDict(builtins);
+  }
+  if (builtins == NULL || !PyDict_Check(builtins)) {
+    builtins = PyEval_GetBuiltins();
+  }
+
+  Py_XINCREF(builtins);
+  Py_XDECREF(code->builtins);
+  code->builtins = builtins;
+  code->builtins_globals = globals;
+  code->builtins_watch = dict_watch((PyDictObject*) globals);
+  if (code->builtins_watch != NULL) {
+    code->builtins_epoch = dict_watch_epoch(code->builtins_watch);
+  }
+  return builtins;
+}
+
+RegisterFrame::RegisterFrame(RegisterCode* rcode, PyObject* obj) :
     code(rcode) {
   instructions_ = code->instructions.data();
+  method_bits_ = 0;
+  return_frame_ = NULL;
+  return_pc_ = NULL;
+  return_reg_ = 0;
+  resume_pc_ = instructions_;
+  yield_reg_ = -1;
+  exc_type_ = exc_value_ = exc_traceback_ = NULL;
+
+  // Compiled code is shared by all functions created from the same code
+  // object; per-function state comes from the function being called.
+  self_ = NULL;
+  function_ = obj;
+  if (PyMethod_Check(obj)) {
+    function_ = PyMethod_GET_FUNCTION(obj);
+    self_ = PyMethod_GET_SELF(obj);
+  }
+  if (!PyFunction_Check(function_)) {
+    function_ = NULL;
+  }
 
-
-  if (rcode->function) {
-    globals_ = PyFunction_GetGlobals(rcode->function);
+  if (function_) {
+    globals_ = PyFunction_GET_GLOBALS(function_);
     locals_ = NULL;
   } else {
     globals_ = PyEval_GetGlobals();
     locals_ = PyEval_GetGlobals();
   }
 
-  Reg_Assert(kw.empty(), "Keyword args not supported.");
+  builtins_ = frame_builtins(rcode, globals_);
 
-  builtins_ = PyEval_GetBuiltins();
+  // Generator frames outlive the call which created them, so they own what
+  // other frames borrow from the caller.  The code object also pins the
+  // compiled code, which the compiler frees once the code object dies.
+  if (code->generator) {
+    Py_XINCREF(function_);
+    Py_XINCREF(globals_);
+    Py_XINCREF(builtins_);
+    Py_INCREF(code->code_);
+  }
 
   names_ = code->names();
   consts_ = code->consts();
 
-#if ! STACK_ALLOC_REGISTERS
-  registers = new Register[rcode->num_registers];
-#endif
-
-  const int num_args = args.size();
-  if (rcode->num_cells > 0) {
-#if ! STACK_ALLOC_REGISTERS
-    freevars = new PyObject*[rcode->num_cells];
-#endif
-    int i;
-    for (i = 0; i < rcode->num_cellvars; ++i) {
-      bool found_argname = false;
-      char *cellname = PyString_AS_STRING(PyTuple_GET_ITEM(rcode->code()->co_cellvars, i));
-      for (int arg_idx = 0; arg_idx < num_args; ++arg_idx) {
-        char* argname = PyString_AS_STRING(PyTuple_GET_ITEM(rcode->code()->co_varnames, arg_idx));
-        if (strcmp(cellname, argname) == 0) {
-          PyObject* arg_value = args[arg_idx].as_obj();
-          freevars[i] = PyCell_New(arg_value);
-          found_argname = true;
-          break;
-        }
-      }
-      if (!found_argname) {
-        freevars[i] = PyCell_New(NULL);
-      }
-    }
+  const int num_registers = code->num_registers;
+  Reg_AssertLt(num_registers, kMaxRegisters);
 
-    PyObject* closure = ((PyFunctionObject*) rcode->function)->func_closure;
-    if (closure) {
-      for (int i = rcode->num_cellvars; i < rcode->num_cells; ++i) {
-        freevars[i] = PyTuple_GET_ITEM(closure, i - rcode->num_cellvars) ;
-        Py_INCREF(freevars[i]);
-      }
-    } else {
-      for (int i = rcode->num_cellvars; i < rcode->num_cells; ++i) {
-        freevars[i] = PyCell_New(NULL);
-      }
-    }
+  // Cells are pointer sized, so they share the register allocation.
+  num_slots_ = num_registers + code->num_cells;
+#if STACK_ALLOC_REGISTERS
+  if (!code->generator) {
+    registers = FrameStack::current()->push(num_slots_);
   } else {
-#if ! STACK_ALLOC_REGISTERS
-            freevars = NULL;
+    registers = new Register[num_slots_];
+  }
+#else
+  registers = new Register[num_slots_];
 #endif
-          }
+  freevars = (PyObject**) (registers + num_registers);
 
-//  Log_Info("Alignments: reg: %d code: %d consts: %d globals: %d, this: %d",
-//           ((long)registers) % 64, ((long)rcode->instructions.data()) % 64, (long)consts_ % 64, (long)globals_ % 64, (long)this % 64);
+  // Constants, followed by cleared registers and cells.
+  memcpy(registers, code->const_registers, sizeof(Register) * num_slots_);
+}
 
-  const int num_registers = code->num_registers;
+// Argument errors are worded as PyEval_EvalCodeEx words them.
+static const char* plural(int n) {
+  return n == 1 ? "" : "s";
+}
 
-  // setup const and local register aliases.
-  int num_consts = PyTuple_GET_SIZE(consts());
-  for (int i = 0; i < num_consts; ++i) {
-    PyObject* v = PyTuple_GET_ITEM(consts(), i) ;
-    Py_INCREF(v);
-    registers[i].store(v);
+static int num_defaults(PyObject* function) {
+  PyObject* def_args = function != NULL ? PyFunction_GET_DEFAULTS(function) : NULL;
+  return def_args == NULL ? 0 : PyTuple_GET_SIZE(def_args);
+}
+
+// Throws for a call passing more positional arguments than co takes; given
+// counts the positional and keyword arguments.
+static void too_many_args(PyCodeObject* co, PyObject* function, int given) {
+  const char* name = PyString_AsString(co->co_name);
+  if (co->co_argcount == 0 && !(co->co_flags & (CO_VARARGS | CO_VARKEYWORDS))) {
+    throw RException(PyExc_TypeError, "%.200s() takes no arguments (%d given)", name, given);
   }
+  throw RException(PyExc_TypeError, "%.200s() takes %s %d argument%s (%d given)", name,
+                   num_defaults(function) ? "at most" : "exactly", co->co_argcount, plural(co->co_argcount),
+                   given);
+}
 
-  int needed_args = code->code()->co_argcount;
-  int offset = num_consts;
-  if (PyMethod_Check(obj)) {
-    PyObject* self = PyMethod_GET_SELF(obj);
+Register* RegisterFrame::arg_slots(int num_args, int num_kwargs) {
+  const int num_self = self_ != NULL ? 1 : 0;
+  if (num_self + num_args > code->code()->co_argcount) {
+    too_many_args(code->code(), function_, num_self + num_args + num_kwargs);
+  }
+  return registers + code->num_consts + num_self;
+}
 
-    Reg_Assert(self != NULL, "Method call without a bound self.");
-    Py_INCREF(self);
-    registers[offset].store(self);
-    ++offset;
+// The index of the parameter of code called name, or -1 if there isn't one.
+static int find_param(const RegisterCode* code, PyObject* name) {
+  PyCodeObject* co = code->code();
+  for (int i = 0; i < co->co_argcount; ++i) {
+    if (PyTuple_GET_ITEM(co->co_varnames, i) == name) {
+      return i;
+    }
+  }
+  if (!PyString_Check(name)) {
+    return -1;
+  }
+  for (int i = 0; i < co->co_argcount; ++i) {
+    if (_PyString_Eq(PyTuple_GET_ITEM(co->co_varnames, i), name)) {
+      return i;
+    }
+  }
+  return -1;
+}
 
-    needed_args--;
+Register& RegisterFrame::kwarg_slot(int num_args, int param) {
+  Register& r = registers[code->num_consts + param];
+  if (param < num_args + (self_ != NULL ? 1 : 0) || !r.empty()) {
+    throw RException(PyExc_TypeError, "%.200s() got multiple values for keyword argument '%.400s'",
+                     PyString_AsString(code->code()->co_name),
+                     PyString_AsString(PyTuple_GET_ITEM(code->varnames(), param)));
   }
+  return r;
+}
 
-  if (code->function) {
-    PyObject* def_args = PyFunction_GET_DEFAULTS(code->function);
-    int num_def_args = def_args == NULL ? 0 : PyTuple_GET_SIZE(def_args);
-    int num_args = args.size();
-    if (num_args + num_def_args < needed_args) {
-      throw RException(PyExc_TypeError, "Wrong number of arguments for %s, expected %d, got %d.",
-                       PyEval_GetFuncName(code->function), needed_args - num_def_args, num_args);
+void RegisterFrame::bind_kwarg(int num_args, int param, Register& value) {
+  Register& r = kwarg_slot(num_args, param);
+  r.store(value);
+  r.incref();
+}
+
+void RegisterFrame::bind_keyword(int num_args, PyObject* name, PyObject* value, PyObject* kwdict) {
+  const char* fn_name = PyString_AsString(code->code()->co_name);
+  if (!PyString_Check(name)) {
+    throw RException(PyExc_TypeError, "%.200s() keywords must be strings", fn_name);
+  }
+
+  int param = find_param(code, name);
+  if (param >= 0) {
+    Register& r = kwarg_slot(num_args, param);
+    Py_INCREF(value);
+    r.store(value);
+  } else if (kwdict != NULL) {
+    if (PyDict_GetItem(kwdict, name) != NULL) {
+      throw RException(PyExc_TypeError, "%.200s() got multiple values for keyword argument '%.400s'", fn_name,
+                       PyString_AsString(name));
+    }
+    if (PyDict_SetItem(kwdict, name, value) != 0) {
+      throw RException();
     }
+  } else {
+    throw RException(PyExc_TypeError, "%.200s() got an unexpected keyword argument '%.400s'", fn_name,
+                     PyString_AsString(name));
+  }
+}
 
-    for (int i = 0; i < needed_args; ++i) {
-      if (i < num_args) {
-        registers[offset].store(args[i]);
-      } else {
-        registers[offset].store(PyTuple_GET_ITEM(def_args, i - num_args) );
-      }
+void RegisterFrame::bind_call(Register* caller, const RegisterOffset* args, int num_args,
+                              const RegisterOffset* kwargs, int num_kwargs, PyObject* star, PyObject* starstar) {
+  PyCodeObject* co = code->code();
+  Register* params = registers + code->num_consts;
+
+  // self is bound here as the first positional argument, since it may end
+  // up in *args.
+  PyObject* self = self_;
+  self_ = NULL;
+  const int num_self = self != NULL ? 1 : 0;
+  const int num_params = co->co_argcount;
+  const int num_star = star != NULL ? PySequence_Fast_GET_SIZE(star) : 0;
+  const int total = num_self + num_args + num_star;
+  const int num_fixed = total < num_params ? total : num_params;
+  const int num_keywords = num_kwargs + (starstar != NULL ? PyDict_Size(starstar) : 0);
+  if (num_params == 0 && !(co->co_flags & (CO_VARARGS | CO_VARKEYWORDS)) && total + num_keywords > 0) {
+    too_many_args(co, function_, total + num_keywords);
+  }
+
+  // The *args and **kwargs parameters follow the named ones.
+  int next_param = co->co_argcount;
+  PyObject* extra = NULL;
+  if (co->co_flags & CO_VARARGS) {
+    extra = PyTuple_New(total > num_params ? total - num_params : 0);
+    params[next_param++].store(extra);
+  } else if (total > num_params) {
+    too_many_args(co, function_, total + num_keywords);
+  }
+
+  PyObject* kwdict = NULL;
+  if (co->co_flags & CO_VARKEYWORDS) {
+    kwdict = PyDict_New();
+    params[next_param++].store(kwdict);
+  }
+
+  for (int i = 0; i < total; ++i) {
+    PyObject* v;
+    if (i < num_self) {
+      v = self;
+    } else if (i < num_self + num_args) {
+      v = caller[args[i - num_self]].as_obj();
+    } else {
+      v = PySequence_Fast_GET_ITEM(star, i - num_self - num_args);
+    }
+    Py_INCREF(v);
+    if (i < num_params) {
+      params[i].store(v);
+    } else {
+      PyTuple_SET_ITEM(extra, i - num_params, v);
+    }
+  }
 
-      registers[offset].incref();
-      ++offset;
+  for (int i = 0; i < num_kwargs; ++i) {
+    bind_keyword(num_fixed, caller[kwargs[2 * i]].as_obj(), caller[kwargs[2 * i + 1]].as_obj(), kwdict);
+  }
+  if (starstar != NULL) {
+    PyObject* k;
+    PyObject* v;
+    Py_ssize_t pos = 0;
+    while (PyDict_Next(starstar, &pos, &k, &v)) {
+      bind_keyword(num_fixed, k, v, kwdict);
     }
   }
 
-  Reg_AssertLt(num_registers, kMaxRegisters);
-  for (register int i = offset; i < num_registers; ++i) {
-    registers[i].reset();
+  bind_args(num_fixed);
+}
+
+void RegisterFrame::bind_args(int num_args) {
+  const int num_consts = code->num_consts;
+  const int num_params = code->code()->co_argcount;
+  int offset = num_consts;
+  if (self_ != NULL) {
+    Py_INCREF(self_);
+    registers[offset].store(self_);
+    ++num_args;
+  }
+
+  // Parameters after the positional arguments take their keyword argument,
+  // or else their default.
+  if (function_ != NULL && num_args < num_params) {
+    PyObject* def_args = PyFunction_GET_DEFAULTS(function_);
+    const int first_default = num_params - num_defaults(function_);
+    for (int i = num_args; i < num_params; ++i) {
+      if (!registers[offset + i].empty()) {
+        continue;
+      }
+      if (i < first_default) {
+        PyCodeObject* co = code->code();
+        int given = 0;
+        for (int j = 0; j < num_params; ++j) {
+          given += registers[offset + j].empty() ? 0 : 1;
+        }
+        throw RException(PyExc_TypeError, "%.200s() takes %s %d argument%s (%d given)",
+                         PyString_AsString(co->co_name),
+                         (co->co_flags & CO_VARARGS) || first_default < num_params ? "at least" : "exactly",
+                         first_default, plural(first_default), given);
+      }
+      PyObject* v = PyTuple_GET_ITEM(def_args, i - first_default);
+      Py_INCREF(v);
+      registers[offset + i].store(v);
+    }
   }
 
+  if (code->num_cells > 0) {
+    for (int i = 0; i < code->num_cellvars; ++i) {
+      const int param = code->cell_params[i];
+      freevars[i] = PyCell_New(param >= 0 ? registers[offset + param].as_obj() : NULL);
+    }
+
+    PyObject* closure = function_ ? PyFunction_GET_CLOSURE(function_) : NULL;
+    for (int i = code->num_cellvars; i < code->num_cells; ++i) {
+      if (closure) {
+        freevars[i] = PyTuple_GET_ITEM(closure, i - code->num_cellvars);
+        Py_INCREF(freevars[i]);
+      } else {
+        freevars[i] = PyCell_New(NULL);
+      }
+    }
+  }
 }
 
 RegisterFrame::~RegisterFrame() {
   const int num_registers = code->num_registers;
-  for (register int i = 0; i < num_registers; ++i) {
+  const int num_consts = code->num_consts;
+#if USED_TYPED_REGISTERS
+  // Reading an unboxed constant as an object boxes it in place.
+  for (register int j = 0; j < code->num_unboxed_consts; ++j) {
+    const int i = code->unboxed_consts[j];
+    if (registers[i].objval != code->const_registers[i].objval) {
+      registers[i].decref();
+    }
+  }
+#endif
+  for (register int i = num_consts; i < num_registers; ++i) {
     registers[i].decref();
   }
 
@@ -215,10 +660,85 @@ RegisterFrame::~RegisterFrame() {
     Py_XDECREF(freevars[i]);
   }
 
-#if ! STACK_ALLOC_REGISTERS
+  if (exc_type_ != NULL) {
+    reset_exc_info();
+  }
+  // Function frames only have a locals dict if locals() created one.
+  if (function_ != NULL) {
+    Py_XDECREF(locals_);
+  }
+
+  const bool generator = code->generator;
+#if STACK_ALLOC_REGISTERS
+  if (!generator) {
+    FrameStack::current()->pop(num_slots_);
+  } else {
+    delete[] registers;
+  }
+#else
   delete[] registers;
-  delete[] freevars;
 #endif
+
+  // Last, since dropping the code object may free the compiled code.
+  if (generator) {
+    PyObject* co = code->code_;
+    Py_XDECREF(function_);
+    Py_XDECREF(globals_);
+    Py_XDECREF(builtins_);
+    Py_DECREF(co);
+  }
+}
+
+int RegisterFrame::traverse(visitproc visit, void* arg) {
+  // Constants are owned by the frame template, and those boxed in place
+  // are ints and floats, which the collector doesn't track.
+  for (int i = code->num_consts; i < code->num_registers; ++i) {
+    Py_VISIT(registers[i].boxed());
+  }
+  for (int i = 0; i < code->num_cells; ++i) {
+    Py_VISIT(freevars[i]);
+  }
+  if (function_ != NULL) {
+    Py_VISIT(locals_);
+  }
+  Py_VISIT(exc_type_);
+  Py_VISIT(exc_value_);
+  Py_VISIT(exc_traceback_);
+  if (code->generator) {
+    Py_VISIT(function_);
+    Py_VISIT(globals_);
+    Py_VISIT(builtins_);
+    Py_VISIT(code->code_);
+  }
+  return 0;
+}
+
+#if STACK_ALLOC_REGISTERS
+// Frames for calls made by compiled code sit on the register stack just
+// below their registers, so a call doesn't touch the heap.
+static const size_t kFrameSlots = (sizeof(RegisterFrame) + sizeof(Register) - 1) / sizeof(Register);
+#endif
+
+// Generator frames are owned by their generator object, not the stack.
+static inline f_inline RegisterFrame* push_frame(RegisterCode* code, PyObject* fn) {
+#if STACK_ALLOC_REGISTERS
+  if (!code->generator) {
+    void* mem = FrameStack::current()->push(kFrameSlots);
+    return new (mem) RegisterFrame(code, fn);
+  }
+#endif
+  return new RegisterFrame(code, fn);
+}
+
+static inline f_inline void pop_frame(RegisterFrame* frame) {
+#if STACK_ALLOC_REGISTERS
+  if (!frame->code->generator) {
+    frame->~RegisterFrame();
+    FrameStack::current()->pop(kFrameSlots);
+    return;
+  }
+#endif
+  delete frame;
 }
 
 Evaluator::Evaluator() {
@@ -226,16 +746,31 @@ Evaluator::Evaluator() {
   bzero(op_times_, sizeof(op_times_));
   total_count_ = 0;
   last_clock_ = 0;
-  hint_hits_ = 0;
-  hint_misses_ = 0;
+  attr_hits_ = 0;
+  attr_misses_ = 0;
+  global_hits_ = 0;
+  global_misses_ = 0;
+  call_hits_ = 0;
+  call_misses_ = 0;
   compiler_ = new Compiler;
-  bzero(hints, sizeof(Hint) * kMaxHints);
-
-  // We use a sentinel value for the invalid hint index.
-  hints[kInvalidHint].guard.obj = NULL;
-  hints[kInvalidHint].key = NULL;
-  hints[kInvalidHint].value = NULL;
-  hints[kInvalidHint].version = (unsigned int) -1;
+  PyType_Ready(&RGen_Type);
+  dict_watch_init();
+  method_descr_type_ = Py_TYPE(PyDict_GetItemString(PyList_Type.tp_dict, "append"));
+  PyObject* range = PyObject_CallFunction((PyObject*) &PyRange_Type, (char*) "i", 0);
+  PyObject* range_iter = PyObject_GetIter(range);
+  range_iter_type_ = Py_TYPE(range_iter);
+  Py_DECREF(range_iter);
+  Py_DECREF(range);
+  PyObject* list = PyList_New(0);
+  PyObject* list_iter = PyObject_GetIter(list);
+  list_iter_type_ = Py_TYPE(list_iter);
+  Py_DECREF(list_iter);
+  Py_DECREF(list);
+  PyObject* tuple = PyTuple_New(0);
+  PyObject* tuple_iter = PyObject_GetIter(tuple);
+  tuple_iter_type_ = Py_TYPE(tuple_iter);
+  Py_DECREF(tuple_iter);
+  Py_DECREF(tuple);
 }
 
 Evaluator::~Evaluator() {
@@ -263,25 +798,78 @@ PyObject* RegisterFrame::locals() {
   for (int i = 0; i < num_locals; ++i) {
     PyObject* v = LOAD_OBJ(num_consts + i);
     if (v != NULL) {
-      Py_INCREF(v);
       PyDict_SetItem(locals_, PyTuple_GetItem(varnames, i), v);
     }
   }
   return locals_;
 }
 
+// As set_exc_info() and reset_exc_info() in ceval.c.
+void RegisterFrame::set_exc_info(PyObject* type, PyObject* value, PyObject* tb) {
+  PyThreadState* tstate = PyThreadState_GET();
+  if (exc_type_ == NULL) {
+    if (tstate->exc_type == NULL) {
+      Py_INCREF(Py_None);
+      tstate->exc_type = Py_None;
+    }
+    Py_INCREF(tstate->exc_type);
+    Py_XINCREF(tstate->exc_value);
+    Py_XINCREF(tstate->exc_traceback);
+    exc_type_ = tstate->exc_type;
+    exc_value_ = tstate->exc_value;
+    exc_traceback_ = tstate->exc_traceback;
+  }
+
+  PyObject* old_type = tstate->exc_type;
+  PyObject* old_value = tstate->exc_value;
+  PyObject* old_tb = tstate->exc_traceback;
+  Py_INCREF(type);
+  Py_XINCREF(value);
+  Py_XINCREF(tb);
+  tstate->exc_type = type;
+  tstate->exc_value = value;
+  tstate->exc_traceback = tb;
+  Py_XDECREF(old_type);
+  Py_XDECREF(old_value);
+  Py_XDECREF(old_tb);
+}
+
+void RegisterFrame::reset_exc_info() {
+  PyThreadState* tstate = PyThreadState_GET();
+  PyObject* old_type = tstate->exc_type;
+  PyObject* old_value = tstate->exc_value;
+  PyObject* old_tb = tstate->exc_traceback;
+  tstate->exc_type = exc_type_;
+  tstate->exc_value = exc_value_;
+  tstate->exc_traceback = exc_traceback_;
+  Py_XDECREF(old_type);
+  Py_XDECREF(old_value);
+  Py_XDECREF(old_tb);
+  exc_type_ = exc_value_ = exc_traceback_ = NULL;
+}
+
 
 //Register
 
+void Evaluator::set_hot_threshold(int threshold) {
+  compiler_->set_hot_threshold(threshold);
+}
+
 PyObject* Evaluator::eval_python(PyObject* func, PyObject* args, PyObject* kw) {
   RegisterFrame* frame;
   try {
+    // An explicit request is compiled right away; only calls made from
+    // compiled code wait for the callee to become hot.
     frame = frame_from_pyfunc(func, args, kw);
   } catch (RException& r) {
     EVAL_LOG("Couldn't compile function, calling CPython...");
     return PyObject_Call(func, args, kw);
   }
 
+  if (frame->code->generator) {
+    return rgen_new(this, frame);
+  }
+
   try {
     Register result = eval(frame);
     delete frame;
@@ -295,9 +883,8 @@ PyObject* Evaluator::eval_python(PyObject* func, PyObject* args, PyObject* kw) {
 RegisterFrame* Evaluator::frame_from_pyframe(PyFrameObject* frame) {
   RegisterCode* regcode = compile((PyObject*) frame->f_code);
 
-  ObjVector v_args;
-  ObjVector kw_args;
-  RegisterFrame* f = new RegisterFrame(regcode, (PyObject*) frame->f_code, v_args, kw_args);
+  RegisterFrame* f = new RegisterFrame(regcode, (PyObject*) frame->f_code);
+  f->bind_args(0);
   PyFrame_FastToLocals(frame);
   f->fill_locals(frame->f_locals);
   return f;
@@ -311,38 +898,34 @@ RegisterFrame* Evaluator::frame_from_pyfunc(PyObject* obj, PyObject* args, PyObj
 
   RegisterCode* regcode = compile(obj);
 
-  ObjVector v_args;
-  v_args.resize(PyTuple_GET_SIZE(args) );
-  for (size_t i = 0; i < v_args.size(); ++i) {
-    v_args[i].store(PyTuple_GET_ITEM(args, i) );
-  }
-
-  ObjVector kw_args;
-
-  size_t n_kwds = 0;
-  if (kw != NULL && PyDict_Check(kw)) {
-    n_kwds =  PyDict_Size(kw);
+  if (kw != NULL && !PyDict_Check(kw)) {
+    throw RException(PyExc_TypeError, "Expected keyword argument dict, got: %s", obj_to_str(PyObject_Type(kw)));
   }
 
-
-  for (size_t i = 0; i < n_kwds; ++i) {
-    throw RException(PyExc_ValueError, "Keywords not yet supported, n_given = %d", n_kwds);
-    // should check whether kw is present in the args
-    // and use default otherwise
-    // kw_args.push_back()
+  RegisterFrame* f = new RegisterFrame(regcode, obj);
+  try {
+    f->bind_call(NULL, NULL, 0, NULL, 0, args, kw);
+  } catch (RException& e) {
+    delete f;
+    throw e;
   }
-  return new RegisterFrame(regcode, obj, v_args, kw_args);
+  return f;
 }
 
 RegisterFrame* Evaluator::frame_from_codeobj(PyObject* code) {
-  ObjVector args, kw;
   RegisterCode *regcode = compile(code);
-  return new RegisterFrame(regcode, code, args, kw);
+  RegisterFrame* f = new RegisterFrame(regcode, code);
+  f->bind_args(0);
+  return f;
 }
 
 void Evaluator::dump_status() {
   Log_Info("Evaluator status:");
   Log_Info("%d operations executed.", total_count_);
+  Log_Info("Attribute cache: %ld hits, %ld misses.", attr_hits_, attr_misses_);
+  Log_Info("Global cache: %ld hits, %ld misses.", global_hits_, global_misses_);
+  Log_Info("Call cache: %ld hits, %ld misses.", call_hits_, call_misses_);
+  Log_Info("Code cache: %ld functions loaded from disk.", disk_cache_loads());
   for (int i = 0; i < 256; ++i) {
     if (op_counts_[i] > 0) {
       Log_Info("%20s : %10d, %.3f", OpUtil::name(i), op_counts_[i], op_times_[i] / 1e9);
@@ -395,24 +978,96 @@ struct BranchOpImpl {
   }
 };
 
-#define OP_OVERFLOWED(a, b, i) ((i ^ a) < 0 && (i ^ b) < 0)
+// Calls return the callee's frame if the eval loop should switch to it, or
+// NULL if the call has already completed.
+template<class SubType>
+struct CallOpImpl {
+  static f_inline const char* eval(Evaluator* eval, RegisterFrame* frame, const char* pc, Register* registers,
+                                   RegisterFrame** callee) {
+    VarRegOp *op = (VarRegOp*) pc;
+    EVAL_LOG("%s -- %5d: %s", frame->str().c_str(), frame->offset(pc), op->str(registers).c_str());
+    pc += op->size();
+    *callee = SubType::_eval(eval, frame, op, registers);
+    return pc;
+  }
+};
 
+// Each op stores a op b in res, or returns false if the result isn't an int
+// (it overflows, or the op raises) so the object path has to handle it.
 struct IntegerOps {
 #define _OP(name, op)\
-  static f_inline long name(long a, long b) {\
-    return (long) ((unsigned long) a op b);\
+  static f_inline bool name(long a, long b, long* res) {\
+    *res = a op b;\
+    return true;\
   }
 
-  _OP(add, +)
-  _OP(sub, -)
-  _OP(mul, *)
-  _OP(div, /)
-  _OP(mod, %)
   _OP(Or, |)
   _OP(Xor, ^)
   _OP(And, &)
-  _OP(Rshift, >>)
-  _OP(Lshift, <<)
+#undef _OP
+
+  static f_inline bool add(long a, long b, long* res) {
+    *res = (long) ((unsigned long) a + b);
+    return (*res ^ a) >= 0 || (*res ^ b) >= 0;
+  }
+
+  static f_inline bool sub(long a, long b, long* res) {
+    *res = (long) ((unsigned long) a - b);
+    return (*res ^ a) >= 0 || (*res ^ ~b) >= 0;
+  }
+
+  static f_inline bool mul(long a, long b, long* res) {
+    __int128 r = (__int128) a * b;
+    *res = (long) r;
+    return r == *res;
+  }
+
+  // Negative shift counts raise from the object path.
+  static f_inline bool Rshift(long a, long b, long* res) {
+    if (b < 0) {
+      return false;
+    }
+    *res = b >= (long) (8 * sizeof(long)) ? (a < 0 ? -1 : 0) : a >> b;
+    return true;
+  }
+
+  static f_inline bool Lshift(long a, long b, long* res) {
+    if (b < 0 || b >= (long) (8 * sizeof(long))) {
+      return false;
+    }
+    *res = (long) ((unsigned long) a << b);
+    return (*res >> b) == a;
+  }
+
+  // Python division floors, C truncates.  A zero divisor has to raise from
+  // the object path.
+  static f_inline bool is_divisible(long a, long b) {
+    return b != 0 && !(b == -1 && a == LONG_MIN);
+  }
+
+  static f_inline bool div(long a, long b, long* res) {
+    if (!is_divisible(a, b)) {
+      return false;
+    }
+    long q = a / b;
+    if ((a % b != 0) && ((a < 0) != (b < 0))) {
+      --q;
+    }
+    *res = q;
+    return true;
+  }
+
+  static f_inline bool mod(long a, long b, long* res) {
+    if (!is_divisible(a, b)) {
+      return false;
+    }
+    long r = a % b;
+    if (r != 0 && ((r < 0) != (b < 0))) {
+      r += b;
+    }
+    *res = r;
+    return true;
+  }
 
   static f_inline PyObject* compare(long a, long b, int arg) {
     switch (arg) {
@@ -441,14 +1096,50 @@ struct IntegerOps {
 };
 
 struct FloatOps {
-  static f_inline PyObject* compare(PyObject* w, PyObject* v, int arg) {
-    if (!PyFloat_CheckExact(v) || !PyFloat_CheckExact(w)) {
-      return NULL;
+#define _OP(name, op)\
+  static f_inline double name(double a, double b) {\
+    return a op b;\
+  }
+
+  _OP(add, +)
+  _OP(sub, -)
+  _OP(mul, *)
+  _OP(div, /)
+#undef _OP
+
+  // Ints take part in float operations if they convert to double exactly;
+  // CPython compares larger ones exactly.
+  static f_inline bool load(Register& r, double* d, bool* is_float) {
+    int type = r.get_type();
+    if (type == IntType) {
+      long v = r.as_int();
+      *d = v;
+      return v >= -(1L << 53) && v <= (1L << 53);
+    }
+#if USED_TYPED_REGISTERS
+    if (type == FloatType) {
+      *d = r.as_float();
+      *is_float = true;
+      return true;
+    }
+#endif
+    PyObject* o = r.as_obj();
+    if (PyFloat_CheckExact(o)) {
+      *d = PyFloat_AS_DOUBLE(o);
+      *is_float = true;
+      return true;
     }
+    return false;
+  }
 
-    double a = PyFloat_AS_DOUBLE(w);
-    double b = PyFloat_AS_DOUBLE(v);
+  // Loads both operands of a float operation: a float and either a float or
+  // an int.
+  static f_inline bool load(Register& r1, Register& r2, double* a, double* b) {
+    bool is_float = false;
+    return load(r1, a, &is_float) && load(r2, b, &is_float) && is_float;
+  }
 
+  static f_inline PyObject* compare(double a, double b, int arg) {
     switch (arg) {
     case PyCmp_LT:
       return a < b ? Py_True : Py_False ;
@@ -462,36 +1153,102 @@ struct FloatOps {
       return a > b ? Py_True : Py_False ;
     case PyCmp_GE:
       return a >= b ? Py_True : Py_False ;
-    case PyCmp_IS:
-      return v == w ? Py_True : Py_False ;
-    case PyCmp_IS_NOT:
-      return v != w ? Py_True : Py_False ;
     default:
       return NULL;
     }
 
     return NULL;
   }
+
+  // Store a float result.  With typed registers most floats are stored
+  // unboxed; otherwise a float object only the destination refers to is
+  // updated in place, rather than allocating a new one.
+  static f_inline void store(Register& dst, double v) {
+#if USED_TYPED_REGISTERS
+    if (dst.get_type() != ObjType) {
+      if (!dst.store_float(v)) {
+        dst.store(new_float(v));
+      }
+      return;
+    }
+#endif
+    PyObject* old = dst.as_obj();
+    if (old != NULL && Py_REFCNT(old) == 1 && PyFloat_CheckExact(old)) {
+      ((PyFloatObject*) old)->ob_fval = v;
+      return;
+    }
+#if USED_TYPED_REGISTERS
+    if (dst.store_float(v)) {
+      Py_XDECREF(old);
+      return;
+    }
+#endif
+    PyObject* res = new_float(v);
+    Py_XDECREF(old);
+    dst.store(res);
+  }
+
+  static f_inline PyObject* new_float(double v) {
+    PyObject* res = PyFloat_FromDouble(v);
+    if (res == NULL) {
+      throw RException();
+    }
+    return res;
+  }
 };
 
-template<int OpCode, PythonBinaryOp ObjF, IntegerBinaryOp IntegerF, bool CanOverFlow>
+// The truth of a register; tagged values are tested without boxing them.
+static inline f_inline bool is_true(Register& r) {
+#if USED_TYPED_REGISTERS
+  switch (r.get_type()) {
+  case IntType:
+    return r.as_int() != 0;
+  case FloatType:
+    return true;
+  case BoolType:
+    return r.as_bool();
+  }
+#endif
+  PyObject* o = r.as_obj();
+  if (o == Py_True) {
+    return true;
+  }
+  if (o == Py_False || o == Py_None) {
+    return false;
+  }
+  int res = PyObject_IsTrue(o);
+  if (res < 0) {
+    throw RException();
+  }
+  return res;
+}
+
+template<int OpCode, PythonBinaryOp ObjF, IntegerBinaryOp IntegerF, FloatBinaryOp FloatF>
 struct BinaryOpWithSpecialization: public RegOpImpl<RegOp<3>,
-    BinaryOpWithSpecialization<OpCode, ObjF, IntegerF, CanOverFlow> > {
+    BinaryOpWithSpecialization<OpCode, ObjF, IntegerF, FloatF> > {
   static f_inline void _eval(Evaluator *eval, RegisterFrame* frame, RegOp<3>& op, Register* registers) {
     Register& r1 = registers[op.reg[0]];
     Register& r2 = registers[op.reg[1]];
 
-    if (r1.get_type() == IntType && r2.get_type() == IntType) {
-      register long a = r1.as_int();
-      register long b = r2.as_int();
-      register long val = IntegerF(a, b);
-      if (!CanOverFlow || !OP_OVERFLOWED(a, b, val)) {
-        STORE_REG(op.reg[2], val);
-        return;
-      }
+    long val;
+    if (IntegerF != nullptr && r1.get_type() == IntType && r2.get_type() == IntType
+        && IntegerF(r1.as_int(), r2.as_int(), &val)) {
+      STORE_REG(op.reg[2], val);
+      return;
+    }
+
+    // Division by zero raises from the object path.
+    double a, b;
+    if (FloatF != nullptr && FloatOps::load(r1, r2, &a, &b) && (FloatF != FloatOps::div || b != 0.0)) {
+      FloatOps::store(registers[op.reg[2]], FloatF(a, b));
+      return;
     }
 
-    STORE_REG(op.reg[2], ObjF(r1.as_obj(), r2.as_obj()));
+    PyObject* r3 = ObjF(r1.as_obj(), r2.as_obj());
+    if (r3 == NULL) {
+      throw RException();
+    }
+    STORE_REG(op.reg[2], r3);
   }
 };
 
@@ -503,6 +1260,9 @@ struct BinaryOp: public RegOpImpl<RegOp<3>, BinaryOp<OpCode, ObjF> > {
     CHECK_VALID(r1);
     CHECK_VALID(r2);
     PyObject* r3 = ObjF(r1, r2);
+    if (r3 == NULL) {
+      throw RException();
+    }
     STORE_REG(op.reg[2], r3);
   }
 };
@@ -516,16 +1276,19 @@ struct UnaryOp: public RegOpImpl<RegOp<2>, UnaryOp<OpCode, ObjF> > {
     PyObject* r1 = LOAD_OBJ(op.reg[0]);
     CHECK_VALID(r1);
     PyObject* r2 = ObjF(r1);
+    if (r2 == NULL) {
+      throw RException();
+    }
     STORE_REG(op.reg[1], r2);
   }
 };
 
 struct UnaryNot: public RegOpImpl<RegOp<2>, UnaryNot> {
   static f_inline void _eval(Evaluator *eval, RegisterFrame* frame, RegOp<2>& op, Register* registers) {
-    PyObject* r1 = LOAD_OBJ(op.reg[0]);
-    PyObject* res = PyObject_IsTrue(r1) ? Py_False : Py_True;
-    Py_INCREF(res);
-    STORE_REG(op.reg[1], res);
+    bool res = !is_true(registers[op.reg[0]]);
+    Register& dst = registers[op.reg[1]];
+    dst.decref();
+    dst.store_bool(res);
   }
 };
 
@@ -539,7 +1302,7 @@ struct BinaryModulo: public RegOpImpl<RegOp<3>, BinaryModulo> {
       long y = r2.as_int();
       // C's modulo differs from Python's remainder when
       // args can be negative
-      if (x >= 0 && y >= 0) {
+      if (x >= 0 && y > 0) {
         Register& dst = registers[op.reg[2]];
         dst.decref();
         dst.store(x % y);
@@ -569,7 +1332,9 @@ struct BinaryPower: public RegOpImpl<RegOp<3>, BinaryPower> {
     PyObject* r2 = LOAD_OBJ(op.reg[1]);
     CHECK_VALID(r2);
     PyObject* r3 = PyNumber_Power(r1, r2, Py_None);
-    CHECK_VALID(r3);
+    if (r3 == NULL) {
+      throw RException();
+    }
 
     STORE_REG(op.reg[2], r3);
   }
@@ -767,18 +1532,21 @@ struct CompareOp: public RegOpImpl<RegOp<3>, CompareOp> {
     Register& r1 = registers[op.reg[0]];
     Register& r2 = registers[op.reg[1]];
     PyObject* r3 = NULL;
+    double a, b;
     if (r1.get_type() == IntType && r2.get_type() == IntType) {
       r3 = IntegerOps::compare(r1.as_int(), r2.as_int(), op.arg);
-    } /* else {
-      r3 = FloatOps::compare(r1.as_obj(), r2.as_obj(), op.arg);
+    } else if (FloatOps::load(r1, r2, &a, &b)) {
+      r3 = FloatOps::compare(a, b, op.arg);
     }
-    */
     if (r3 != NULL) {
-      Py_INCREF(r3);
-    } else {
-      // r3 = PyObject_RichCompare(r1.as_obj(), r2.as_obj(), op.arg);
-      r3 = cmp_outcome(op.arg, r1.as_obj(), r2.as_obj());
+      Register& dst = registers[op.reg[2]];
+      dst.decref();
+      dst.store_bool(r3 == Py_True);
+      return;
     }
+
+    // r3 = PyObject_RichCompare(r1.as_obj(), r2.as_obj(), op.arg);
+    r3 = cmp_outcome(op.arg, r1.as_obj(), r2.as_obj());
     if (!r3) {
       throw RException();
     }
@@ -802,9 +1570,9 @@ struct DictContains : public RegOpImpl<RegOp<3>, DictContains> {
         throw RException();
       }
     }
-    PyObject* result = result_code ? Py_True : Py_False;
-    Py_INCREF(result);
-    STORE_REG(op.reg[2], result);
+    Register& dst = registers[op.reg[2]];
+    dst.decref();
+    dst.store_bool(result_code);
   }
 };
 
@@ -832,19 +1600,58 @@ struct LoadLocals: public RegOpImpl<RegOp<1>, LoadLocals> {
 struct LoadGlobal: public RegOpImpl<RegOp<1>, LoadGlobal> {
   static f_inline void _eval(Evaluator *eval, RegisterFrame* frame, RegOp<1>& op, Register* registers) {
     PyObject* key = PyTuple_GET_ITEM(frame->names(), op.arg) ;
-    PyObject* value = PyDict_GetItem(frame->globals(), key);
-    if (value != NULL) {
-      Py_INCREF(value);
-      STORE_REG(op.reg[0], value);
-      return;
+    PyDictObject* globals = (PyDictObject*) frame->globals();
+#if GETATTR_HINTS
+    GlobalCache* cache = NULL;
+    if (op.hint_pos != kInvalidHint) {
+      cache = &frame->code->global_caches[op.hint_pos];
+      const GlobalCache& c = *cache;
+      if (c.globals == globals && (!c.in_builtins || (dict_is_watched(globals)
+          && c.watch_epoch == dict_watch_epoch(c.watch)))) {
+        PyDictObject* d = c.in_builtins ? (PyDictObject*) frame->builtins() : globals;
+        if (c.dict == d && d->ma_table == c.table && d->ma_mask == c.mask
+            && c.entry->me_key == key && c.entry->me_value != NULL) {
+          ++eval->global_hits_;
+          PyObject* value = c.entry->me_value;
+          Py_INCREF(value);
+          STORE_REG(op.reg[0], value);
+          return;
+        }
+      }
+      ++eval->global_misses_;
     }
-    value = PyDict_GetItem(frame->builtins(), key);
-    if (value != NULL) {
-      Py_INCREF(value);
-      STORE_REG(op.reg[0], value);
-      return;
+#endif
+    PyDictObject* dict = globals;
+    PyDictEntry* ep = dict_entry(dict, key);
+    if (ep == NULL) {
+      dict = (PyDictObject*) frame->builtins();
+      ep = dict_entry(dict, key);
+    }
+    if (ep == NULL) {
+      throw RException(PyExc_NameError, "Global name %.200s not defined.", obj_to_str(key));
+    }
+
+    PyObject* value = ep->me_value;
+    Py_INCREF(value);
+#if GETATTR_HINTS
+    if (cache != NULL && PyString_CheckExact(key)) {
+      cache->globals = globals;
+      cache->dict = dict;
+      cache->table = dict->ma_table;
+      cache->mask = dict->ma_mask;
+      cache->entry = ep;
+      cache->in_builtins = dict != globals;
+      if (cache->in_builtins) {
+        cache->watch = dict_watch(globals);
+        if (cache->watch == NULL) {
+          cache->globals = NULL;
+        } else {
+          cache->watch_epoch = dict_watch_epoch(cache->watch);
+        }
+      }
     }
-    throw RException(PyExc_NameError, "Global name %.200s not defined.", obj_to_str(key));
+#endif
+    STORE_REG(op.reg[0], value);
   }
 };
 
@@ -904,19 +1711,6 @@ struct LoadFast: public RegOpImpl<RegOp<2>, LoadFast> {
 };
 typedef LoadFast StoreFast;
 
-struct StoreAttr: public RegOpImpl<RegOp<2>, StoreAttr> {
-  static f_inline void _eval(Evaluator *eval, RegisterFrame* frame, RegOp<2>& op, Register* registers) {
-    PyObject* obj = LOAD_OBJ(op.reg[0]);
-    PyObject* key = PyTuple_GET_ITEM(frame->names(), op.arg);
-    PyObject* value = LOAD_OBJ(op.reg[1]);
-    CHECK_VALID(obj);
-    CHECK_VALID(key);
-    CHECK_VALID(value);
-    if (PyObject_SetAttr(obj, key, value) != 0) {
-      throw RException();
-    }
-  }
-};
 
 
 
@@ -1045,34 +1839,75 @@ static PyDictObject* obj_getdictptr(PyObject* obj, PyTypeObject* type) {
   return NULL;
 }
 
+// Functions and C method descriptors found on the type can be called with
+// self as the first argument instead of being bound first.
+static inline f_inline bool is_unbound_method(PyObject* descr) {
+  return PyFunction_Check(descr) || Py_TYPE(descr) == method_descr_type_;
+}
+
 static size_t dict_getoffset(PyDictObject* dict, PyObject* key) {
-  long hash;
-  if (!PyString_CheckExact(key) || (hash = ((PyStringObject *) key)->ob_shash) == -1) {
-    hash = PyObject_Hash(key);
+  PyDictEntry* pos = dict->ma_lookup(dict, key, str_hash(key));
+  return pos - dict->ma_table;
+}
+
+static inline f_inline bool dict_has_key(PyDictObject* dict, PyObject* key) {
+  if (dict == NULL || dict->ma_used == 0) {
+    return false;
   }
+  PyDictEntry* pos = dict->ma_lookup(dict, key, str_hash(key));
+  if (pos == NULL) {
+    throw RException();
+  }
+  return pos->me_value != NULL;
+}
 
-  PyDictEntry* pos = dict->ma_lookup(dict, key, hash);
-  return pos - dict->ma_table;
+static inline f_inline PyObject* call_getter(descrgetfunc getter, PyObject* descr, PyObject* obj, PyTypeObject* type) {
+  PyObject* res = getter(descr, obj, (PyObject*) type);
+  if (res == NULL) {
+    throw RException();
+  }
+  return res;
 }
 
-// LOAD_ATTR is common enough to warrant inlining some common code.
-// Most of this is taken from _PyObject_GenericGetAttrWithDict
-static PyObject * obj_getattr(Evaluator* eval, RegOp<2>& op, PyObject *obj, PyObject *name) {
-  PyObjHelper<PyTypeObject*> type(Py_TYPE(obj) );
-  PyObjHelper<PyDictObject*> dict(obj_getdictptr(obj, type));
-  PyObject *descr = NULL;
-#if GETATTR_HINTS
-  const Hint &op_hint = eval->hints[op.hint_pos];
+static void attr_cache_fill(AttrCache* cache, PyTypeObject* type, int kind, PyObject* descr, descrgetfunc getter,
+                            PyDictObject* dict, PyObject* name) {
+  if (cache == NULL || !PyType_HasFeature(type, Py_TPFLAGS_VALID_VERSION_TAG)) {
+    return;
+  }
 
-  // A hint for an instance dictionary lookup.
-  if (dict.val_ && op_hint.guard.dict_size == dict->ma_mask) {
-    const PyDictEntry &e(dict->ma_table[op_hint.version]);
-    if (e.me_key == name) {
-      Py_INCREF(e.me_value);
-      return e.me_value;
+  // Prefer replacing an entry for the same type (which must be stale)
+  // or an empty entry before evicting a live one.
+  AttrCacheEntry* e = NULL;
+  for (int i = 0; i < kAttrCacheEntries; ++i) {
+    AttrCacheEntry& c = cache->entries[i];
+    if (c.kind == kAttrEmpty || c.type == type) {
+      e = &c;
+      break;
     }
   }
-#endif
+  if (e == NULL) {
+    e = &cache->entries[cache->next_victim];
+    cache->next_victim = (cache->next_victim + 1) % kAttrCacheEntries;
+  }
+
+  e->type = type;
+  e->version = type->tp_version_tag;
+  e->kind = kind;
+  e->descr = descr;
+  e->getter = getter;
+  if (kind == kAttrDictSlot) {
+    e->dict_mask = dict->ma_mask;
+    e->dict_slot = dict_getoffset(dict, name);
+  }
+}
+
+// The uncached version of LOAD_ATTR; records the result in the call site cache if possible.
+// Most of this is taken from _PyObject_GenericGetAttrWithDict
+//
+// If unbound is non-NULL (LOAD_METHOD), functions found on the type are returned
+// without binding them to obj, and *unbound is set to true.
+static PyObject* obj_getattr_slow(Evaluator* eval, AttrCache* cache, PyObject *obj, PyObject *name, bool* unbound) {
+  PyTypeObject* type = Py_TYPE(obj);
 
   if (!PyString_Check(name)) {
     throw RException(PyExc_SystemError, "attribute name must be string, not '%.200s'", Py_TYPE(name) ->tp_name);
@@ -1084,61 +1919,39 @@ static PyObject * obj_getattr(Evaluator* eval, RegOp<2>& op, PyObject *obj, PyOb
     }
   }
 
-  // A hint for a type dictionary lookup, we've cached the 'descr' object.
-//  if (op_hint.guard.obj == type && op_hint.key == name && op_hint.version == type->tp_version_tag) {
-//    descr = op_hint.value;
-//  } else {
-  descr = _PyType_Lookup(type, name);
-//  }
-
+  PyObject* descr = _PyType_Lookup(type, name);
   descrgetfunc getter = NULL;
   if (descr != NULL && PyType_HasFeature(descr->ob_type, Py_TPFLAGS_HAVE_CLASS)) {
     getter = descr->ob_type->tp_descr_get;
     if (getter != NULL && PyDescr_IsData(descr)) {
-      return getter(descr, obj, (PyObject*) type);
+      attr_cache_fill(cache, type, kAttrDataDescr, descr, getter, NULL, name);
+      return call_getter(getter, descr, obj, type);
     }
   }
 
   // Look for a match in our object dictionary
+  PyDictObject* dict = obj_getdictptr(obj, type);
   if (dict != NULL) {
-    PyObject* res = PyDict_GetItem(dict, name);
-    // We found a match.  Create a hint for where to look next time.
+    PyObject* res = PyDict_GetItem((PyObject*) dict, name);
     if (res != NULL) {
-#if GETATTR_HINTS
-      size_t hint_pos = hint_offset(type, name);
-      size_t dict_pos = dict_getoffset(dict, name);
-
-      Hint h;
-      h.guard.dict_size = dict->ma_mask;
-      h.key = name;
-      h.value = type;
-      h.version = dict_pos;
-      eval->hints[hint_pos] = h;
-      op.hint_pos = hint_pos;
-#endif
+      attr_cache_fill(cache, type, kAttrDictSlot, NULL, NULL, dict, name);
       Py_INCREF(res);
       return res;
     }
   }
 
-  // Instance dictionary lookup failed, try to find a match in the class hierarchy.
-  if (getter != NULL) {
-    PyObject* res = getter(descr, obj, (PyObject*) type);
-    if (res != NULL) {
-//      size_t hint_pos = hint_offset(type, name);
-//      Hint h;
-//      h.guard.obj = type;
-//      h.key = name;
-//      h.value = descr;
-//      h.version = type->tp_version_tag;
-//      eval->hints[hint_pos] = h;
-//      op.hint_pos = hint_pos;
-
-      return res;
-    }
-  }
-
+  // Instance dictionary lookup failed, use the match from the class hierarchy.
   if (descr != NULL) {
+    attr_cache_fill(cache, type, kAttrTypeValue, descr, getter, NULL, name);
+    if (unbound != NULL && is_unbound_method(descr)) {
+      *unbound = true;
+      Py_INCREF(descr);
+      return descr;
+    }
+    if (getter != NULL) {
+      return call_getter(getter, descr, obj, type);
+    }
+    Py_INCREF(descr);
     return descr;
   }
 
@@ -1146,15 +1959,198 @@ static PyObject * obj_getattr(Evaluator* eval, RegOp<2>& op, PyObject *obj, PyOb
                    PyString_AS_STRING(name) );
 }
 
+// LOAD_ATTR is common enough to warrant inlining some common code.
+static inline f_inline PyObject* obj_getattr(Evaluator* eval, RegisterFrame* frame, RegOp<2>& op, PyObject *obj, PyObject *name,
+                                      bool* unbound) {
+  PyTypeObject* type = Py_TYPE(obj);
+
+  // Objects with custom attribute lookup (classes, old-style instances, ...)
+  // go through the normal Python path.
+  if (type->tp_getattro != PyObject_GenericGetAttr) {
+    PyObject* res = PyObject_GetAttr(obj, name);
+    if (res == NULL) {
+      throw RException();
+    }
+    return res;
+  }
+
+  AttrCache* cache = NULL;
+#if GETATTR_HINTS
+  if (op.hint_pos != kInvalidHint) {
+    cache = &frame->code->attr_caches[op.hint_pos];
+  }
+
+  if (cache != NULL && PyType_HasFeature(type, Py_TPFLAGS_VALID_VERSION_TAG)) {
+    for (int i = 0; i < kAttrCacheEntries; ++i) {
+      const AttrCacheEntry& e = cache->entries[i];
+      if (e.type != type || e.version != type->tp_version_tag) {
+        continue;
+      }
+
+      switch (e.kind) {
+      case kAttrDictSlot: {
+        PyDictObject* dict = obj_getdictptr(obj, type);
+        if (dict != NULL && dict->ma_mask == e.dict_mask) {
+          const PyDictEntry& de = dict->ma_table[e.dict_slot];
+          if (de.me_key == name && de.me_value != NULL) {
+            ++eval->attr_hits_;
+            Py_INCREF(de.me_value);
+            return de.me_value;
+          }
+        }
+        break;
+      }
+      case kAttrDataDescr:
+        ++eval->attr_hits_;
+        return call_getter(e.getter, e.descr, obj, type);
+      case kAttrTypeValue:
+        if (!dict_has_key(obj_getdictptr(obj, type), name)) {
+          ++eval->attr_hits_;
+          if (unbound != NULL && is_unbound_method(e.descr)) {
+            *unbound = true;
+            Py_INCREF(e.descr);
+            return e.descr;
+          }
+          if (e.getter != NULL) {
+            return call_getter(e.getter, e.descr, obj, type);
+          }
+          Py_INCREF(e.descr);
+          return e.descr;
+        }
+        break;
+      }
+    }
+  }
+  ++eval->attr_misses_;
+#endif
+
+  return obj_getattr_slow(eval, cache, obj, name, unbound);
+}
+
+// Store value into the instance dictionary slot remembered by a STORE_ATTR
+// cache entry.  Existing keys are overwritten in place; a missing key is
+// inserted only if the slot is the first probe for the name (so the key
+// can't be elsewhere in the table) and the insert wouldn't resize the table.
+static inline f_inline bool dict_store_slot(PyDictObject* dict, const AttrCacheEntry& e, PyObject* name, PyObject* value) {
+  if (dict == NULL || dict->ma_mask != e.dict_mask) {
+    return false;
+  }
+
+  PyDictEntry& de = dict->ma_table[e.dict_slot];
+  if (de.me_key == name && de.me_value != NULL) {
+    PyObject* old = de.me_value;
+    Py_INCREF(value);
+    de.me_value = value;
+    Py_DECREF(old);
+  } else if (de.me_key == NULL && dict->ma_lookup == lookdict_string_
+      && e.dict_slot == (str_hash(name) & dict->ma_mask)
+      && (dict->ma_fill + 1) * 3 < (dict->ma_mask + 1) * 2) {
+    Py_INCREF(name);
+    Py_INCREF(value);
+    de.me_key = name;
+    de.me_hash = str_hash(name);
+    de.me_value = value;
+    dict->ma_fill++;
+    dict->ma_used++;
+  } else {
+    return false;
+  }
+
+  if (!_PyObject_GC_IS_TRACKED(dict) && _PyObject_GC_MAY_BE_TRACKED(value)) {
+    PyObject_GC_Track(dict);
+  }
+  return true;
+}
+
+// After a successful generic store, remember the dictionary slot if the
+// type doesn't intercept stores to this name.
+static void store_attr_fill(AttrCache* cache, PyObject* obj, PyObject* name) {
+  PyTypeObject* type = Py_TYPE(obj);
+  if (cache == NULL || type->tp_setattro != PyObject_GenericSetAttr || !PyString_CheckExact(name)) {
+    return;
+  }
+
+  PyObject* descr = _PyType_Lookup(type, name);
+  if (descr != NULL && PyType_HasFeature(descr->ob_type, Py_TPFLAGS_HAVE_CLASS)
+      && descr->ob_type->tp_descr_set != NULL) {
+    return;
+  }
+
+  PyDictObject* dict = obj_getdictptr(obj, type);
+  if (dict != NULL) {
+    attr_cache_fill(cache, type, kAttrDictSlot, NULL, NULL, dict, name);
+  }
+}
+
+struct StoreAttr: public RegOpImpl<RegOp<2>, StoreAttr> {
+  static f_inline void _eval(Evaluator *eval, RegisterFrame* frame, RegOp<2>& op, Register* registers) {
+    PyObject* obj = LOAD_OBJ(op.reg[0]);
+    PyObject* key = PyTuple_GET_ITEM(frame->names(), op.arg);
+    PyObject* value = LOAD_OBJ(op.reg[1]);
+    CHECK_VALID(obj);
+    CHECK_VALID(key);
+    CHECK_VALID(value);
+
+    AttrCache* cache = NULL;
+#if GETATTR_HINTS
+    if (op.hint_pos != kInvalidHint) {
+      cache = &frame->code->attr_caches[op.hint_pos];
+    }
+
+    PyTypeObject* type = Py_TYPE(obj);
+    if (cache != NULL && PyType_HasFeature(type, Py_TPFLAGS_VALID_VERSION_TAG)) {
+      for (int i = 0; i < kAttrCacheEntries; ++i) {
+        const AttrCacheEntry& e = cache->entries[i];
+        if (e.type != type || e.version != type->tp_version_tag) {
+          continue;
+        }
+
+        // Instance dictionaries are created lazily by the first store.
+        PyDictObject* dict = obj_getdictptr(obj, type);
+        if (dict == NULL && type->tp_dictoffset > 0) {
+          dict = (PyDictObject*) PyDict_New();
+          *(PyObject**) ((char*) obj + type->tp_dictoffset) = (PyObject*) dict;
+        }
+
+        if (dict_store_slot(dict, e, key, value)) {
+          ++eval->attr_hits_;
+          return;
+        }
+        break;
+      }
+    }
+    ++eval->attr_misses_;
+#endif
+
+    if (PyObject_SetAttr(obj, key, value) != 0) {
+      throw RException();
+    }
+    store_attr_fill(cache, obj, key);
+  }
+};
+
 struct LoadAttr: public RegOpImpl<RegOp<2>, LoadAttr> {
   static f_inline void _eval(Evaluator *eval, RegisterFrame* frame, RegOp<2>& op, Register* registers) {
     PyObject* obj = LOAD_OBJ(op.reg[0]);
     PyObject* name = PyTuple_GET_ITEM(frame->names(), op.arg);
-    PyObject* res = obj_getattr(eval, op, obj, name);
+    PyObject* res = obj_getattr(eval, frame, op, obj, name, NULL);
     STORE_REG(op.reg[1], res);
-//    Py_INCREF(LOAD_OBJ(op.reg[1]));
-      }
-    };
+  }
+};
+
+// LOAD_METHOD is a LOAD_ATTR whose result is only used as the callee of
+// the matching CALL_METHOD.  Plain functions are left unbound; the frame's
+// method bit tells CALL_METHOD to pass obj as the first argument.
+struct LoadMethod: public RegOpImpl<RegOp<2>, LoadMethod> {
+  static f_inline void _eval(Evaluator *eval, RegisterFrame* frame, RegOp<2>& op, Register* registers) {
+    PyObject* obj = LOAD_OBJ(op.reg[0]);
+    PyObject* name = PyTuple_GET_ITEM(frame->names(), op.arg);
+    bool unbound = false;
+    PyObject* res = obj_getattr(eval, frame, op, obj, name, &unbound);
+    frame->push_method_bit(unbound);
+    STORE_REG(op.reg[1], res);
+  }
+};
 
 struct LoadDeref: public RegOpImpl<RegOp<1>, LoadDeref> {
   static f_inline void _eval(Evaluator *eval, RegisterFrame* frame, RegOp<1>& op, Register* registers) {
@@ -1188,33 +2184,279 @@ struct MakeFunction: public VarArgsOpImpl<MakeFunction> {
     for (int i = 0; i < op->arg; ++i) {
       PyTuple_SetItem(defaults, i, LOAD_OBJ(op->reg[i + 1]));
     }
-    PyFunction_SetDefaults(func, defaults);
-    STORE_REG(op->reg[op->arg + 1], func);
+    PyFunction_SetDefaults(func, defaults);
+    STORE_REG(op->reg[op->arg + 1], func);
+  }
+};
+
+struct MakeClosure: public VarArgsOpImpl<MakeClosure> {
+  static f_inline void _eval(Evaluator* eval, RegisterFrame* frame, VarRegOp *op, Register* registers) {
+    // first register argument is the code object
+    // second is the closure args tuple
+    // rest of the registers are default argument values
+    PyObject* code = LOAD_OBJ(op->reg[0]);
+    PyObject* func = PyFunction_New(code, frame->globals());
+    PyObject* closure_values = LOAD_OBJ(op->reg[1]);
+    PyFunction_SetClosure(func, closure_values);
+
+    PyObject* defaults = PyTuple_New(op->arg);
+    for (int i = 0; i < op->arg; ++i) {
+      PyTuple_SetItem(defaults, i, LOAD_OBJ(op->reg[i + 2]));
+    }
+    PyFunction_SetDefaults(func, defaults);
+    STORE_REG(op->reg[op->arg + 2], func);
+  }
+};
+
+// Returns the compiled code for the callee of a call site, or NULL if it
+// should be run by CPython.  The result is remembered by the site, so repeated
+// calls of the same function skip the type checks and the compile cache.
+static inline f_inline RegisterCode* call_site_code(Evaluator* eval, RegisterFrame* frame, VarRegOp* op, PyObject* fn) {
+  PyObject* callee = PyMethod_Check(fn) ? PyMethod_GET_FUNCTION(fn) : fn;
+  if (PyFunction_Check(callee)) {
+    callee = PyFunction_GET_CODE(callee);
+  }
+
+  /* TODO:
+   *   Actually accelerate object construction in Falcon by
+   *   first creating the raw/unitialized object and then
+   *   compiling the __init__ method of the called class.
+   *
+   *   To actually get a performance gain from this we would need
+   *   special instance dictionaries which store Falcon registers
+   *   and only lazily construct PyObject representations when asked
+   *   by other Python C API code.
+   */
+  // Only Python functions are compiled.  Other callees aren't cached either:
+  // bound builtin methods are created per call, and the cache would keep
+  // their self alive.
+  if (!PyCode_Check(callee)) {
+    return NULL;
+  }
+
+  CallCache* cache = NULL;
+#if GETATTR_HINTS
+  if (op->hint_pos != kInvalidHint) {
+    cache = &frame->code->call_caches[op->hint_pos];
+    if (cache->callee == callee && cache->epoch == eval->code_epoch()) {
+      ++eval->call_hits_;
+      return cache->code;
+    }
+  }
+  ++eval->call_misses_;
+#endif
+
+  RegisterCode* code = NULL;
+  bool cold = false;
+  try {
+    code = eval->compile_if_hot(fn);
+    cold = code == NULL;
+  } catch (RException& e) {
+    Log_Info("Failed to compile function, executing using ceval: %s", obj_to_str(e.value));
+    code = NULL;
+  }
+
+  // Cold functions are left uncached so the compiler keeps counting calls.
+  if (cache != NULL && !cold) {
+    cache->callee = callee;
+    cache->epoch = eval->code_epoch();
+    cache->code = code;
+    cache->kw_code = NULL;
+  }
+  return code;
+}
+
+// Keyword arguments are matched to parameters once per call site and callee:
+// returns the parameter each of the nk keywords binds to, where the names are
+// in op->reg[first], op->reg[first + 2], ...  Returns NULL if one of them
+// isn't a parameter, leaving CPython to handle (or report) the call.
+static inline f_inline const uint8_t* keyword_params(RegisterFrame* frame, VarRegOp* op, RegisterCode* code, int first,
+                                              int nk, Register* registers) {
+#if GETATTR_HINTS
+  if (op->hint_pos == kInvalidHint) {
+    return NULL;
+  }
+  CallCache* cache = &frame->code->call_caches[op->hint_pos];
+  if (cache->kw_code == code) {
+    return cache->kw_params;
+  }
+
+  if (cache->kw_params == NULL) {
+    cache->kw_params = new uint8_t[nk];
+  }
+  for (int i = 0; i < nk; ++i) {
+    int param = find_param(code, LOAD_OBJ(op->reg[first + 2 * i]));
+    if (param < 0) {
+      return NULL;
+    }
+    cache->kw_params[i] = param;
+  }
+  cache->kw_code = code;
+  return cache->kw_params;
+#else
+  return NULL;
+#endif
+}
+
+// Completes a call into compiled code once the callee's arguments are bound.
+// With INLINE_CALLS the frame is handed back to the eval loop, which switches
+// to it and stores the result in dst when it returns; otherwise it is run here.
+static inline f_inline RegisterFrame* enter_call(Evaluator* eval, RegisterFrame* callee, int dst, Register* registers) {
+  // Calling a generator function just creates the generator.
+  if (callee->code->generator) {
+    STORE_REG(dst, rgen_new(eval, callee));
+    return NULL;
+  }
+#if INLINE_CALLS
+  callee->return_reg_ = dst;
+  return callee;
+#else
+  if (Py_EnterRecursiveCall(" in Falcon call")) {
+    pop_frame(callee);
+    throw RException();
+  }
+  Register res;
+  try {
+    res = eval->eval(callee);
+  } catch (RException& e) {
+    pop_frame(callee);
+    Py_LeaveRecursiveCall();
+    throw;
+  }
+  pop_frame(callee);
+  Py_LeaveRecursiveCall();
+  STORE_REG(dst, res);
+  return NULL;
+#endif
+}
+
+// Converts the * and ** arguments of a call site (either may be NULL) to a
+// tuple or list and a dict, as ext_do_call does.  Returns new references;
+// tuples, lists and dicts are passed through without copying.
+static void star_args(PyObject* fn, PyObject* star, PyObject* starstar, PyObject** seq, PyObject** dict) {
+  *seq = NULL;
+  *dict = NULL;
+  if (star != NULL) {
+    if (PyTuple_CheckExact(star) || PyList_CheckExact(star)) {
+      Py_INCREF(star);
+      *seq = star;
+    } else {
+      *seq = PySequence_Fast(star, "");
+      if (*seq == NULL) {
+        PyErr_Clear();
+        throw RException(PyExc_TypeError, "%s%s argument after * must be a sequence, not %s",
+                         PyEval_GetFuncName(fn), PyEval_GetFuncDesc(fn), Py_TYPE(star)->tp_name);
+      }
+    }
+  }
+  if (starstar != NULL) {
+    if (PyDict_CheckExact(starstar)) {
+      Py_INCREF(starstar);
+      *dict = starstar;
+    } else {
+      *dict = PyDict_New();
+      if (PyDict_Update(*dict, starstar) != 0) {
+        Py_DECREF(*dict);
+        Py_XDECREF(*seq);
+        if (PyErr_ExceptionMatches(PyExc_AttributeError)) {
+          PyErr_Clear();
+          throw RException(PyExc_TypeError, "%s%s argument after ** must be a mapping, not %s",
+                           PyEval_GetFuncName(fn), PyEval_GetFuncDesc(fn), Py_TYPE(starstar)->tp_name);
+        }
+        throw RException();
+      }
+    }
+  }
+}
+
+// Calls fn through CPython: the positional arguments are the num_args
+// registers at args followed by the items of star, the keyword arguments the
+// num_kwargs register pairs at kwargs followed by the items of starstar.
+static PyObject* call_object(PyObject* fn, Register* registers, const RegisterOffset* args, int num_args,
+                             const RegisterOffset* kwargs, int num_kwargs, PyObject* star, PyObject* starstar) {
+  PyObject* seq;
+  PyObject* dict;
+  star_args(fn, star, starstar, &seq, &dict);
+
+  const int num_star = seq != NULL ? PySequence_Fast_GET_SIZE(seq) : 0;
+  PyObject* arg_tuple;
+  if (num_args == 0 && seq != NULL && PyTuple_CheckExact(seq)) {
+    arg_tuple = seq;
+    seq = NULL;
+  } else {
+    arg_tuple = PyTuple_New(num_args + num_star);
+    for (register int i = 0; i < num_args; ++i) {
+      PyObject* v = LOAD_OBJ(args[i]);
+      Py_INCREF(v);
+      PyTuple_SET_ITEM(arg_tuple, i, v);
+    }
+    for (register int i = 0; i < num_star; ++i) {
+      PyObject* v = PySequence_Fast_GET_ITEM(seq, i);
+      Py_INCREF(v);
+      PyTuple_SET_ITEM(arg_tuple, num_args + i, v);
+    }
+    Py_XDECREF(seq);
+  }
+
+  PyObject* kwdict = dict;
+  if (num_kwargs > 0) {
+    // The ** dict may be the caller's, so keyword arguments go in a copy.
+    kwdict = dict != NULL ? PyDict_Copy(dict) : PyDict_New();
+    Py_XDECREF(dict);
+    for (register int i = 0; i < num_kwargs; ++i) {
+      PyObject* k = LOAD_OBJ(kwargs[2 * i]);
+      PyObject* v = LOAD_OBJ(kwargs[2 * i + 1]);
+      if (starstar != NULL && PyDict_GetItem(kwdict, k) != NULL) {
+        Py_DECREF(arg_tuple);
+        Py_DECREF(kwdict);
+        throw RException(PyExc_TypeError, "%s%s got multiple values for keyword argument '%s'",
+                         PyEval_GetFuncName(fn), PyEval_GetFuncDesc(fn), PyString_AsString(k));
+      }
+      PyDict_SetItem(kwdict, k, v);
+    }
   }
-};
-
-struct MakeClosure: public VarArgsOpImpl<MakeClosure> {
-  static f_inline void _eval(Evaluator* eval, RegisterFrame* frame, VarRegOp *op, Register* registers) {
-    // first register argument is the code object
-    // second is the closure args tuple
-    // rest of the registers are default argument values
-    PyObject* code = LOAD_OBJ(op->reg[0]);
-    PyObject* func = PyFunction_New(code, frame->globals());
-    PyObject* closure_values = LOAD_OBJ(op->reg[1]);
-    PyFunction_SetClosure(func, closure_values);
 
-    PyObject* defaults = PyTuple_New(op->arg);
-    for (int i = 0; i < op->arg; ++i) {
-      PyTuple_SetItem(defaults, i, LOAD_OBJ(op->reg[i + 2]));
-    }
-    PyFunction_SetDefaults(func, defaults);
-    STORE_REG(op->reg[op->arg + 2], func);
+  PyObject* res;
+  if (PyCFunction_Check(fn)) {
+    res = PyCFunction_Call(fn, arg_tuple, kwdict);
+  } else {
+    res = PyObject_Call(fn, arg_tuple, kwdict);
   }
-};
+  Py_DECREF(arg_tuple);
+  Py_XDECREF(kwdict);
+  if (res == NULL) {
+    throw RException();
+  }
+  return res;
+}
+
+// Calls compiled code through the general binder, for call sites passing *
+// or ** arguments and for callees taking them.
+static inline f_inline RegisterFrame* call_code(Evaluator* eval, RegisterCode* code, PyObject* fn, int dst,
+                                         Register* registers, const RegisterOffset* args, int num_args,
+                                         const RegisterOffset* kwargs, int num_kwargs, PyObject* star,
+                                         PyObject* starstar) {
+  PyObject* seq;
+  PyObject* dict;
+  star_args(fn, star, starstar, &seq, &dict);
+
+  RegisterFrame* f = push_frame(code, fn);
+  try {
+    f->bind_call(registers, args, num_args, kwargs, num_kwargs, seq, dict);
+  } catch (RException& e) {
+    pop_frame(f);
+    Py_XDECREF(seq);
+    Py_XDECREF(dict);
+    throw;
+  }
+  Py_XDECREF(seq);
+  Py_XDECREF(dict);
+  return enter_call(eval, f, dst, registers);
+}
 
 template <bool HasVarArgs, bool HasKwDict>
-struct CallFunction: public VarArgsOpImpl<CallFunction<HasVarArgs, HasKwDict> > {
-  static f_inline void _eval(Evaluator* eval, RegisterFrame* frame, VarRegOp *op, Register* registers) {
+struct CallFunction: public CallOpImpl<CallFunction<HasVarArgs, HasKwDict> > {
+  static f_inline RegisterFrame* _eval(Evaluator* eval, RegisterFrame* frame, VarRegOp *op, Register* registers) {
     int na = op->arg & 0xff;
     int nk = (op->arg >> 8) & 0xff;
     int n = nk * 2 + na;
@@ -1228,70 +2470,161 @@ struct CallFunction: public VarArgsOpImpl<CallFunction<HasVarArgs, HasKwDict> >
 
     Reg_AssertEq(n + 2, op->num_registers);
 
-    RegisterCode* code = NULL;
-
-    /* TODO:
-     *   Actually accelerate object construction in Falcon by
-     *   first creating the raw/unitialized object and then
-     *   compiling the __init__ method of the called class.
-     *
-     *   To actually get a performance gain from this we would need
-     *   special instance dictionaries which store Falcon registers
-     *   and only lazily construct PyObject representations when asked
-     *   by other Python C API code.
-     */
-    if (!PyCFunction_Check(fn) && !PyClass_Check(fn)) {
-      try {
-        code = eval->compile(fn);
-      } catch (RException& e) {
-        Log_Info("Failed to compile function, executing using ceval: %s", obj_to_str(e.value));
+    RegisterCode* code = call_site_code(eval, frame, op, fn);
+    if (HasVarArgs || HasKwDict) {
+      PyObject* star = HasVarArgs ? LOAD_OBJ(op->reg[n - HasKwDict]) : NULL;
+      PyObject* starstar = HasKwDict ? LOAD_OBJ(op->reg[n]) : NULL;
+      if (code != NULL) {
+        return call_code(eval, code, fn, dst, registers, &op->reg[1], na, &op->reg[na + 1], nk, star, starstar);
+      }
+      STORE_REG(dst, call_object(fn, registers, &op->reg[1], na, &op->reg[na + 1], nk, star, starstar));
+      return NULL;
+    }
+
+    if (code != NULL && code->varargs) {
+      return call_code(eval, code, fn, dst, registers, &op->reg[1], na, &op->reg[na + 1], nk, NULL, NULL);
+    }
+
+    const uint8_t* kw_params = NULL;
+    if (code != NULL && nk > 0) {
+      kw_params = keyword_params(frame, op, code, na + 1, nk, registers);
+      if (kw_params == NULL) {
         code = NULL;
       }
     }
 
-    if (code == NULL || nk > 0) {
-      PyObject* args = PyTuple_New(na);
+    if (code == NULL) {
+      STORE_REG(dst, call_object(fn, registers, &op->reg[1], na, &op->reg[na + 1], nk, NULL, NULL));
+      return NULL;
+    }
 
+    RegisterFrame* f = push_frame(code, fn);
+    try {
+      Register* args = f->arg_slots(na, nk);
       for (register int i = 0; i < na; ++i) {
-        PyObject* v = LOAD_OBJ(op->reg[i+1]);
-        Py_INCREF(v);
-        PyTuple_SET_ITEM(args, i, v);
+        args[i].store(registers[op->reg[i+1]]);
+        args[i].incref();
       }
-
-      PyObject* kwdict = NULL;
-      if (nk > 0) {
-        kwdict = PyDict_New();
-        for (register int i = na; i < nk * 2 ; i += 2) {
-          // starting at +1 since the first register was the fn
-          // so keyword args actually start at na+1
-          PyObject* k = LOAD_OBJ(op->reg[i+1]);
-          PyObject* v = LOAD_OBJ(op->reg[i+2]);
-          PyDict_SetItem(kwdict, k, v);
-        }
+      for (register int i = 0; i < nk; ++i) {
+        f->bind_kwarg(na, kw_params[i], registers[op->reg[na + 2 * i + 2]]);
       }
+      f->bind_args(na);
+    } catch (RException& e) {
+      pop_frame(f);
+      throw;
+    }
+    return enter_call(eval, f, dst, registers);
+  }
+};
 
-      PyObject* res = NULL;
-      if (PyCFunction_Check(fn)) {
-        res = PyCFunction_Call(fn, args, kwdict);
-      } else {
-        res = PyObject_Call(fn, args, kwdict);
-      }
-      Py_DECREF(args);
+// Calls a C method descriptor without creating a bound builtin method.
+// The descriptor was found on the type of self, so no type check is needed.
+static inline f_inline PyObject* call_method_descr(PyObject* descr, PyObject* self, VarRegOp* op, int na,
+                                            Register* registers) {
+  PyMethodDef* ml = ((PyMethodDescrObject*) descr)->d_method;
+  int flags = ml->ml_flags & ~(METH_CLASS | METH_STATIC | METH_COEXIST);
+  if (flags == METH_NOARGS && na == 0) {
+    return ml->ml_meth(self, NULL);
+  }
+  if (flags == METH_O && na == 1) {
+    return ml->ml_meth(self, LOAD_OBJ(op->reg[2]));
+  }
+
+  if (flags == METH_VARARGS || flags == (METH_VARARGS | METH_KEYWORDS)) {
+    PyObject* args = PyTuple_New(na);
+    for (register int i = 0; i < na; ++i) {
+      PyObject* v = LOAD_OBJ(op->reg[i + 2]);
+      Py_INCREF(v);
+      PyTuple_SET_ITEM(args, i, v);
+    }
+    PyObject* res;
+    if (flags & METH_KEYWORDS) {
+      res = ((PyCFunctionWithKeywords) ml->ml_meth)(self, args, NULL);
+    } else {
+      res = ml->ml_meth(self, args);
+    }
+    Py_DECREF(args);
+    return res;
+  }
+
+  // Argument count mismatches and old-style calling conventions: let the
+  // descriptor produce the error or do the conversion.
+  PyObject* args = PyTuple_New(na + 1);
+  Py_INCREF(self);
+  PyTuple_SET_ITEM(args, 0, self);
+  for (register int i = 0; i < na; ++i) {
+    PyObject* v = LOAD_OBJ(op->reg[i + 2]);
+    Py_INCREF(v);
+    PyTuple_SET_ITEM(args, i + 1, v);
+  }
+  PyObject* res = PyObject_Call(descr, args, NULL);
+  Py_DECREF(args);
+  return res;
+}
+
+// Registers are [fn, obj, args..., dst]; fn comes from the matching LOAD_METHOD.
+// If that left fn unbound, obj is passed as the first argument.
+struct CallMethod: public CallOpImpl<CallMethod> {
+  static f_inline RegisterFrame* _eval(Evaluator* eval, RegisterFrame* frame, VarRegOp *op, Register* registers) {
+    int na = op->arg & 0xff;
+    int nk = (op->arg >> 8) & 0xff;
+    int n = nk * 2 + na;
+
+    Reg_AssertEq(n + 3, op->num_registers);
+
+    int dst = op->reg[n + 2];
+    PyObject* fn = LOAD_OBJ(op->reg[0]);
+    PyObject* self = frame->pop_method_bit() ? LOAD_OBJ(op->reg[1]) : NULL;
 
+    if (self != NULL && nk == 0 && Py_TYPE(fn) == method_descr_type_) {
+      PyObject* res = call_method_descr(fn, self, op, na, registers);
       if (res == NULL) {
         throw RException();
       }
-
       STORE_REG(dst, res);
-    } else {
-      ObjVector args, kw;
-      args.resize(na);
+      return NULL;
+    }
+
+    RegisterCode* code = call_site_code(eval, frame, op, fn);
+    const int self_offset = self != NULL ? 1 : 0;
+    const RegisterOffset* args = &op->reg[2 - self_offset];
+    if (code != NULL && code->varargs) {
+      return call_code(eval, code, fn, dst, registers, args, na + self_offset, &op->reg[na + 2], nk, NULL, NULL);
+    }
+
+    const uint8_t* kw_params = NULL;
+    if (code != NULL && nk > 0) {
+      kw_params = keyword_params(frame, op, code, na + 2, nk, registers);
+      if (kw_params == NULL) {
+        code = NULL;
+      }
+    }
+
+    if (code == NULL) {
+      STORE_REG(dst, call_object(fn, registers, args, na + self_offset, &op->reg[na + 2], nk, NULL, NULL));
+      return NULL;
+    }
+
+    RegisterFrame* f = push_frame(code, fn);
+    try {
+      Register* args = f->arg_slots(na + self_offset, nk);
+      if (self != NULL) {
+        args[0].store(registers[op->reg[1]]);
+        args[0].incref();
+      }
       for (register int i = 0; i < na; ++i) {
-        args[i].store(registers[op->reg[i+1]]);
+        args[i + self_offset].store(registers[op->reg[i + 2]]);
+        args[i + self_offset].incref();
+      }
+      for (register int i = 0; i < nk; ++i) {
+        f->bind_kwarg(na + self_offset, kw_params[i], registers[op->reg[na + 2 * i + 3]]);
       }
-      RegisterFrame f(code, fn, args, kw);
-      STORE_REG(dst, eval->eval(&f));
+      f->bind_args(na + self_offset);
+    } catch (RException& e) {
+      pop_frame(f);
+      throw;
     }
+    return enter_call(eval, f, dst, registers);
   }
 };
 
@@ -1307,13 +2640,162 @@ struct GetIter: public RegOpImpl<RegOp<2>, GetIter> {
   }
 };
 
+// Advance a dict iterator as dictiter_iternext* do, returning the entry
+// reached.  Returns NULL once the dict is exhausted, with an exception set if
+// it changed size.
+static inline f_inline PyDictEntry* dict_iter_next(DictIterObject* di) {
+  PyDictObject* d = di->di_dict;
+  if (d == NULL) {
+    return NULL;
+  }
+  if (di->di_used != d->ma_used) {
+    PyErr_SetString(PyExc_RuntimeError, "dictionary changed size during iteration");
+    di->di_used = -1;
+    return NULL;
+  }
+
+  Py_ssize_t i = di->di_pos;
+  if (i >= 0) {
+    PyDictEntry* ep = d->ma_table;
+    while (i <= d->ma_mask && ep[i].me_value == NULL) {
+      ++i;
+    }
+    di->di_pos = i + 1;
+    if (i <= d->ma_mask) {
+      --di->len;
+      return &ep[i];
+    }
+  }
+
+  di->di_dict = NULL;
+  Py_DECREF(d);
+  return NULL;
+}
+
+// Like PyIter_Next, but steps list, tuple and dict iterators and falcon
+// generators directly.
+static inline f_inline PyObject* iter_next(PyObject* it) {
+  PyTypeObject* type = Py_TYPE(it);
+  PyObject* item;
+  if (type == list_iter_type_) {
+    ListIterObject* l = (ListIterObject*) it;
+    PyListObject* seq = l->it_seq;
+    if (seq != NULL && l->it_index < PyList_GET_SIZE(seq)) {
+      item = seq->ob_item[l->it_index++];
+      Py_INCREF(item);
+      return item;
+    }
+    l->it_seq = NULL;
+    Py_XDECREF(seq);
+    return NULL;
+  }
+
+  if (type == tuple_iter_type_) {
+    TupleIterObject* t = (TupleIterObject*) it;
+    PyTupleObject* seq = t->it_seq;
+    if (seq != NULL && t->it_index < PyTuple_GET_SIZE(seq)) {
+      item = seq->ob_item[t->it_index++];
+      Py_INCREF(item);
+      return item;
+    }
+    t->it_seq = NULL;
+    Py_XDECREF(seq);
+    return NULL;
+  }
+
+  if (type == &PyDictIterKey_Type || type == &PyDictIterValue_Type) {
+    PyDictEntry* ep = dict_iter_next((DictIterObject*) it);
+    if (ep == NULL) {
+      return NULL;
+    }
+    item = type == &PyDictIterKey_Type ? ep->me_key : ep->me_value;
+    Py_INCREF(item);
+    return item;
+  }
+
+  if (RGen_CheckExact(it)) {
+    return rgen_next((RGenObject*) it);
+  }
+  return PyIter_Next(it);
+}
+
+// Store new references to the n items of seq in items, as UNPACK_SEQUENCE
+// does.  Returns false with an exception set if seq doesn't have exactly n
+// items.
+static bool unpack_sequence(PyObject* seq, int n, PyObject** items) {
+  PyObject** src = NULL;
+  if (PyTuple_CheckExact(seq) && PyTuple_GET_SIZE(seq) == n) {
+    src = &PyTuple_GET_ITEM(seq, 0);
+  } else if (PyList_CheckExact(seq) && PyList_GET_SIZE(seq) == n) {
+    src = PySequence_Fast_ITEMS(seq);
+  }
+  if (src != NULL) {
+    for (int i = 0; i < n; ++i) {
+      items[i] = src[i];
+      Py_INCREF(items[i]);
+    }
+    return true;
+  }
+
+  PyObject* it = PyObject_GetIter(seq);
+  if (it == NULL) {
+    return false;
+  }
+
+  int i;
+  PyObject* extra;
+  for (i = 0; i < n; ++i) {
+    items[i] = PyIter_Next(it);
+    if (items[i] == NULL) {
+      if (!PyErr_Occurred()) {
+        PyErr_Format(PyExc_ValueError, "need more than %d value%s to unpack", i, i == 1 ? "" : "s");
+      }
+      goto failed;
+    }
+  }
+
+  extra = PyIter_Next(it);
+  if (extra == NULL && !PyErr_Occurred()) {
+    Py_DECREF(it);
+    return true;
+  }
+  if (extra != NULL) {
+    Py_DECREF(extra);
+    PyErr_SetString(PyExc_ValueError, "too many values to unpack");
+  }
+
+failed:
+  for (int j = 0; j < i; ++j) {
+    Py_DECREF(items[j]);
+  }
+  Py_DECREF(it);
+  return false;
+}
+
 struct ForIter: public BranchOpImpl<BranchOp<2>, ForIter> {
   static f_inline void _eval(Evaluator* eval, RegisterFrame *frame, BranchOp<2>& op, const char **pc, Register* registers) {
-    CHECK_VALID(LOAD_OBJ(op.reg[0]));
-    PyObject* iter = PyIter_Next(LOAD_OBJ(op.reg[0]));
+    PyObject* it = LOAD_OBJ(op.reg[0]);
+    CHECK_VALID(it);
+
+    // Counted loops over xrange() store the next value directly; with typed
+    // registers this never allocates.
+    if (Py_TYPE(it) == range_iter_type_) {
+      RangeIterObject* r = (RangeIterObject*) it;
+      if (r->index < r->len) {
+        STORE_REG(op.reg[1], r->start + (r->index++) * r->step);
+        *pc += sizeof(BranchOp<2>);
+      } else {
+        *pc = frame->instructions() + op.label;
+      }
+      return;
+    }
+
+    PyObject* iter = iter_next(it);
     if (iter) {
       STORE_REG(op.reg[1], iter);
       *pc += sizeof(BranchOp<2>);
+    } else if (PyErr_Occurred()) {
+      throw RException();
     } else {
       *pc = frame->instructions() + op.label;
     }
@@ -1321,28 +2803,70 @@ struct ForIter: public BranchOpImpl<BranchOp<2>, ForIter> {
   }
 };
 
-struct JumpIfFalseOrPop: public BranchOpImpl<BranchOp<1>, JumpIfFalseOrPop> {
-  static f_inline void _eval(Evaluator* eval, RegisterFrame *frame, BranchOp<1>& op, const char **pc, Register* registers) {
-    PyObject *r1 = LOAD_OBJ(op.reg[0]);
-    if (r1 == Py_False || (PyObject_IsTrue(r1) == 0)) {
-//      EVAL_LOG("Jumping: %s -> %d", obj_to_str(r1), op.label);
+// FOR_ITER followed by unpacking the item into two registers.  Items from
+// dict.iteritems() are read straight from the dict, without building a tuple.
+struct ForIterPair: public BranchOpImpl<BranchOp<3>, ForIterPair> {
+  static f_inline void _eval(Evaluator* eval, RegisterFrame *frame, BranchOp<3>& op, const char **pc, Register* registers) {
+    PyObject* it = LOAD_OBJ(op.reg[0]);
+    CHECK_VALID(it);
+
+    PyObject* items[2];
+    if (Py_TYPE(it) == &PyDictIterItem_Type) {
+      PyDictEntry* ep = dict_iter_next((DictIterObject*) it);
+      if (ep == NULL) {
+        if (PyErr_Occurred()) {
+          throw RException();
+        }
         *pc = frame->instructions() + op.label;
-      } else {
-        *pc += sizeof(BranchOp<1>);
+        return;
+      }
+      items[0] = ep->me_key;
+      items[1] = ep->me_value;
+      Py_INCREF(items[0]);
+      Py_INCREF(items[1]);
+    } else {
+      PyObject* item = iter_next(it);
+      if (item == NULL) {
+        if (PyErr_Occurred()) {
+          throw RException();
+        }
+        *pc = frame->instructions() + op.label;
+        return;
       }
+      bool unpacked = unpack_sequence(item, 2, items);
+      Py_DECREF(item);
+      if (!unpacked) {
+        throw RException();
+      }
+    }
 
+    {
+      STORE_REG(op.reg[1], items[0]);
     }
-  };
+    {
+      STORE_REG(op.reg[2], items[1]);
+    }
+    *pc += sizeof(BranchOp<3>);
+  }
+};
 
-struct JumpIfTrueOrPop: public BranchOpImpl<BranchOp<1>, JumpIfTrueOrPop> {
+struct JumpIfFalseOrPop: public BranchOpImpl<BranchOp<1>, JumpIfFalseOrPop> {
   static f_inline void _eval(Evaluator* eval, RegisterFrame *frame, BranchOp<1>& op, const char **pc, Register* registers) {
-    PyObject* r1 = LOAD_OBJ(op.reg[0]);
-    if (r1 == Py_True || (PyObject_IsTrue(r1) == 1)) {
+    if (!is_true(registers[op.reg[0]])) {
       *pc = frame->instructions() + op.label;
     } else {
       *pc += sizeof(BranchOp<1>);
     }
+  }
+};
 
+struct JumpIfTrueOrPop: public BranchOpImpl<BranchOp<1>, JumpIfTrueOrPop> {
+  static f_inline void _eval(Evaluator* eval, RegisterFrame *frame, BranchOp<1>& op, const char **pc, Register* registers) {
+    if (is_true(registers[op.reg[0]])) {
+      *pc = frame->instructions() + op.label;
+    } else {
+      *pc += sizeof(BranchOp<1>);
+    }
   }
 };
 
@@ -1373,6 +2897,194 @@ struct ReturnValue {
   }
 };
 
+// Builds the tuple returned by RETURN_VALUES when the caller doesn't take
+// the values directly.
+struct ReturnValues {
+  static f_inline Register* eval(Evaluator* eval, RegisterFrame* frame, const char* pc, Register* registers,
+                                 Register* result) {
+    VarRegOp* op = (VarRegOp*) pc;
+    EVAL_LOG("%s -- %5d: %s", frame->str().c_str(), frame->offset(pc), op->str(registers).c_str());
+    register int count = op->arg;
+    PyObject* t = PyTuple_New(count);
+    if (t == NULL) {
+      throw RException();
+    }
+    for (register int i = 0; i < count; ++i) {
+      PyObject* v = LOAD_OBJ(op->reg[i]);
+      Py_INCREF(v);
+      PyTuple_SET_ITEM(t, i, v);
+    }
+    result->store(t);
+    return result;
+  }
+
+  // Is the caller of frame about to unpack exactly the values op returns?
+  static f_inline bool unpacked(RegisterFrame* frame, const char* pc) {
+    VarRegOp* op = (VarRegOp*) pc;
+    VarRegOp* next = (VarRegOp*) frame->return_pc_;
+    return next->code == UNPACK_RESULT && next->arg == op->arg && next->reg[0] == frame->return_reg_;
+  }
+};
+
+// Suspends the generator running this frame; the evaluator returns the
+// value to the generator, and resumes after this op on the next send().
+struct YieldValue {
+  static f_inline Register* eval(Evaluator* eval, RegisterFrame* frame, const char* pc, Register* registers) {
+    RegOp<2>& op = *((RegOp<2>*) pc);
+    EVAL_LOG("%s -- %5d: %s", frame->str().c_str(), frame->offset(pc), op.str(registers).c_str());
+    frame->resume_pc_ = pc + op.size();
+    frame->yield_reg_ = op.reg[1];
+    // Like ceval, a suspended generator doesn't keep the exception it is
+    // handling as the thread's current one.
+    if (frame->exc_type_ != NULL) {
+      frame->reset_exc_info();
+    }
+    Register& r = registers[op.reg[0]];
+    r.incref();
+    return &r;
+  }
+};
+
+// The first op of an exception handler.  The evaluator jumps here with the
+// exception set; it is moved into the (type, value, traceback) registers
+// CPython would push.  For except blocks (arg 1) the exception is normalized
+// and becomes the one returned by sys.exc_info().
+struct LoadException: public RegOpImpl<RegOp<3>, LoadException> {
+  static f_inline void _eval(Evaluator *eval, RegisterFrame* frame, RegOp<3>& op, Register* registers) {
+    PyObject *type, *value, *tb;
+    PyErr_Fetch(&type, &value, &tb);
+    Reg_Assert(type != NULL, "Entered an exception handler without an exception.");
+    if (value == NULL) {
+      Py_INCREF(Py_None);
+      value = Py_None;
+    }
+    if (op.arg) {
+      PyErr_NormalizeException(&type, &value, &tb);
+      frame->set_exc_info(type, value, tb);
+    }
+    if (tb == NULL) {
+      Py_INCREF(Py_None);
+      tb = Py_None;
+    }
+
+    registers[op.reg[0]].decref();
+    registers[op.reg[0]].store(type);
+    registers[op.reg[1]].decref();
+    registers[op.reg[1]].store(value);
+    registers[op.reg[2]].decref();
+    registers[op.reg[2]].store(tb);
+  }
+};
+
+// Registers are (type, value, traceback), as stored by LOAD_EXCEPTION.
+// A None type means the finally block was entered without an exception;
+// anything else is raised again.
+struct EndFinally: public RegOpImpl<RegOp<3>, EndFinally> {
+  static f_inline void _eval(Evaluator *eval, RegisterFrame* frame, RegOp<3>& op, Register* registers) {
+    PyObject* type = LOAD_OBJ(op.reg[0]);
+    if (type == Py_None) {
+      return;
+    }
+    if (!PyExceptionClass_Check(type) && !PyString_Check(type)) {
+      throw RException(PyExc_SystemError, "'finally' pops bad exception");
+    }
+
+    PyObject* value = LOAD_OBJ(op.reg[1]);
+    PyObject* tb = LOAD_OBJ(op.reg[2]);
+    Py_INCREF(type);
+    Py_INCREF(value);
+    Py_INCREF(tb);
+    PyErr_Restore(type, value, tb);
+
+    RException error;
+    error.reraise = true;
+    throw error;
+  }
+};
+
+// As do_raise() in ceval.c: sets the exception for a raise statement (type
+// is NULL for a bare raise) and returns true if the traceback was supplied.
+// Steals the references to its arguments.
+static bool do_raise(PyObject* type, PyObject* value, PyObject* tb) {
+  if (type == NULL) {
+    PyThreadState* tstate = PyThreadState_GET();
+    type = tstate->exc_type == NULL ? Py_None : tstate->exc_type;
+    value = tstate->exc_value;
+    tb = tstate->exc_traceback;
+    Py_XINCREF(type);
+    Py_XINCREF(value);
+    Py_XINCREF(tb);
+  }
+
+  if (tb == Py_None) {
+    Py_DECREF(tb);
+    tb = NULL;
+  } else if (tb != NULL && !PyTraceBack_Check(tb)) {
+    PyErr_SetString(PyExc_TypeError, "raise: arg 3 must be a traceback or None");
+    goto raise_error;
+  }
+
+  if (value == NULL) {
+    value = Py_None;
+    Py_INCREF(value);
+  }
+
+  // raise <tuple> raises its first item.
+  while (PyTuple_Check(type) && PyTuple_Size(type) > 0) {
+    PyObject* tmp = type;
+    type = PyTuple_GET_ITEM(type, 0);
+    Py_INCREF(type);
+    Py_DECREF(tmp);
+  }
+
+  if (PyExceptionClass_Check(type)) {
+    PyErr_NormalizeException(&type, &value, &tb);
+    if (!PyExceptionInstance_Check(value)) {
+      PyErr_Format(PyExc_TypeError, "calling %s() should have returned an instance of BaseException, not '%s'",
+                   ((PyTypeObject*) type)->tp_name, Py_TYPE(value)->tp_name);
+      goto raise_error;
+    }
+  } else if (PyExceptionInstance_Check(type)) {
+    if (value != Py_None) {
+      PyErr_SetString(PyExc_TypeError, "instance exception may not have a separate value");
+      goto raise_error;
+    }
+    Py_DECREF(value);
+    value = type;
+    type = PyExceptionInstance_Class(type);
+    Py_INCREF(type);
+  } else {
+    PyErr_Format(PyExc_TypeError, "exceptions must be old-style classes or derived from BaseException, not %s",
+                 Py_TYPE(type)->tp_name);
+    goto raise_error;
+  }
+
+  PyErr_Restore(type, value, tb);
+  return tb != NULL;
+
+raise_error:
+  Py_XDECREF(value);
+  Py_XDECREF(type);
+  Py_XDECREF(tb);
+  return false;
+}
+
+// Registers are (type, value, traceback); arg is how many were given.
+struct RaiseVarargs: public RegOpImpl<RegOp<3>, RaiseVarargs> {
+  static void _eval(Evaluator *eval, RegisterFrame* frame, RegOp<3>& op, Register* registers) {
+    PyObject* args[3] = { NULL, NULL, NULL };
+    for (int i = 0; i < op.arg; ++i) {
+      args[i] = LOAD_OBJ(op.reg[i]);
+      Py_INCREF(args[i]);
+    }
+
+    bool reraise = do_raise(args[0], args[1], args[2]);
+    RException error;
+    error.reraise = reraise;
+    throw error;
+  }
+};
+
 struct Nop: public RegOpImpl<RegOp<0>, Nop> {
   static f_inline void _eval(Evaluator *eval, RegisterFrame* frame, RegOp<0>& op, Register* registers) {
 
@@ -1392,6 +3104,41 @@ struct BuildTuple: public VarArgsOpImpl<BuildTuple> {
   }
 };
 
+// reg[0] is the sequence, followed by the registers for its arg items.
+struct UnpackSequence: public VarArgsOpImpl<UnpackSequence> {
+  static f_inline void _eval(Evaluator* eval, RegisterFrame* frame, VarRegOp *op, Register* registers) {
+    register int count = op->arg;
+    PyObject* seq = LOAD_OBJ(op->reg[0]);
+    if (PyTuple_CheckExact(seq) && PyTuple_GET_SIZE(seq) == count) {
+      // The tuple's register may be one of the destinations.
+      Py_INCREF(seq);
+      for (register int i = 0; i < count; ++i) {
+        PyObject* v = PyTuple_GET_ITEM(seq, i);
+        Py_INCREF(v);
+        STORE_REG(op->reg[i + 1], v);
+      }
+      Py_DECREF(seq);
+      return;
+    }
+
+    // Anything else is unpacked up front: releasing the old values of the
+    // destinations can run arbitrary code, which may change a list.
+    PyObject* small[8];
+    std::vector<PyObject*> large;
+    PyObject** items = small;
+    if (count > 8) {
+      large.resize(count);
+      items = large.data();
+    }
+    if (!unpack_sequence(seq, count, items)) {
+      throw RException();
+    }
+    for (register int i = 0; i < count; ++i) {
+      STORE_REG(op->reg[i + 1], items[i]);
+    }
+  }
+};
+
 struct BuildList: public VarArgsOpImpl<BuildList> {
   static f_inline void _eval(Evaluator* eval, RegisterFrame* frame, VarRegOp *op, Register* registers) {
     register int count = op->arg;
@@ -1669,14 +3416,38 @@ struct ImportFrom: public RegOpImpl<RegOp<2>, ImportFrom> {
     op_##opname:\
       _DEFINE_OP(opname, impl)
 
+// Switches to the callee's frame if the call didn't complete; its
+// RETURN_VALUE resumes this frame at pc.
+#define CALL_OP(opname, impl)\
+    op_##opname: {\
+      RegisterFrame* callee;\
+      const char* next = impl::eval(this, frame, pc, registers, &callee);\
+      if (callee != NULL) {\
+        if (Py_EnterRecursiveCall(" in Falcon call")) {\
+          pop_frame(callee);\
+          throw RException();\
+        }\
+        callee->return_frame_ = frame;\
+        callee->return_pc_ = next;\
+        frame = callee;\
+        registers = frame->registers;\
+        next = frame->instructions();\
+      }\
+      pc = next;\
+      JUMP_TO(frame->next_code(pc));\
+    }
+
 #define BAD_OP(opname)\
     op_##opname:\
      BadOp<opname>::eval(this, frame, registers);
 
 #define FALLTHROUGH(opname) op_##opname:
 
-#define BINARY_OP3(opname, objfn, intfn, can_overflow)\
-    op_##opname: _DEFINE_OP(opname, BinaryOpWithSpecialization<CONCAT(opname, objfn, intfn, can_overflow)>)
+#define BINARY_OP3(opname, objfn, intfn)\
+    op_##opname: _DEFINE_OP(opname, BinaryOpWithSpecialization<CONCAT(opname, objfn, intfn, nullptr)>)
+
+#define NUMBER_OP3(opname, objfn, intfn, floatfn)\
+    op_##opname: _DEFINE_OP(opname, BinaryOpWithSpecialization<CONCAT(opname, objfn, intfn, floatfn)>)
 
 #define BINARY_OP2(opname, objfn)\
     op_##opname: _DEFINE_OP(opname, BinaryOp<CONCAT(opname, objfn)>)
@@ -1684,15 +3455,17 @@ struct ImportFrom: public RegOpImpl<RegOp<2>, ImportFrom> {
 #define UNARY_OP2(opname, objfn)\
     op_##opname: _DEFINE_OP(opname, UnaryOp<CONCAT(opname, objfn)>)
 
-Register Evaluator::eval(RegisterFrame* f) {
+Register Evaluator::eval(RegisterFrame* f, bool raise) {
   register RegisterFrame* frame = f;
   register Register* registers asm("r15") = frame->registers;
-  register const char* pc asm("r14") = frame->instructions();
+  register const char* pc asm("r14") = frame->resume_pc_;
 
   Reg_Assert(frame != NULL, "NULL frame object.");
   // Reg_Assert(PyTuple_GET_SIZE(frame->code->code()->co_cellvars) == 0, "Cell vars (closures) not supported.");
 
   Register* result;
+  // The tuple built by RETURN_VALUES.
+  Register values;
 
 //  last_clock_ = rdtsc();
 
@@ -1856,15 +3629,78 @@ static const void* labels[] = {
   OFFSET(DICT_CONTAINS),
   OFFSET(STORE_SUBSCR_LIST),
   OFFSET(STORE_SUBSCR_DICT),
+  OFFSET(LOAD_METHOD),
+  OFFSET(CALL_METHOD),
+  OFFSET(LOAD_EXCEPTION),
+  OFFSET(FOR_ITER_PAIR),
+  OFFSET(RETURN_VALUES),
+  OFFSET(UNPACK_RESULT),
 }
 ;
 
 //EVAL_LOG("Entering frame: %s", frame->str().c_str());
+// Exceptions with a handler in a frame of this loop restart dispatch there.
+for (;;) {
 try {
+    if (raise) {
+      // Raise from inside the YIELD_VALUE the frame was suspended at, so
+      // its handlers apply.
+      raise = false;
+      pc -= 1;
+      throw RException();
+    }
+    JUMP_TO(frame->next_code(pc));
+
+op_RETURN_VALUES: {
+  if (frame != f && ReturnValues::unpacked(frame, pc)) {
+    // Store the values straight into the registers the caller's
+    // UNPACK_RESULT writes, and resume after it.
+    VarRegOp* op = (VarRegOp*) pc;
+    RegisterFrame* callee = frame;
+    frame = callee->return_frame_;
+    VarRegOp* unpack = (VarRegOp*) callee->return_pc_;
+    pc = callee->return_pc_ + unpack->size();
+    for (register int i = 0; i < op->arg; ++i) {
+      Register& r = registers[op->reg[i]];
+      r.incref();
+      Register& dst = frame->registers[unpack->reg[i + 1]];
+      dst.decref();
+      dst.store(r);
+    }
+    pop_frame(callee);
+    Py_LeaveRecursiveCall();
+
+    registers = frame->registers;
     JUMP_TO(frame->next_code(pc));
+  }
+  result = ReturnValues::eval(this, frame, pc, registers, &values);
+  goto return_result;
+}
 
 op_RETURN_VALUE: {
   result = ReturnValue::eval(this, frame, pc, registers);
+return_result:
+  if (frame == f) {
+    goto done;
+  }
+
+  // Returning from a call made by this loop: resume the caller.
+  Register value = *result;
+  RegisterFrame* callee = frame;
+  const int dst = callee->return_reg_;
+  frame = callee->return_frame_;
+  pc = callee->return_pc_;
+  pop_frame(callee);
+  Py_LeaveRecursiveCall();
+
+  registers = frame->registers;
+  STORE_REG(dst, value);
+  JUMP_TO(frame->next_code(pc));
+}
+
+op_YIELD_VALUE: {
+  result = YieldValue::eval(this, frame, pc, registers);
+  Reg_Assert(frame == f, "Yield from a frame entered by a call.");
   goto done;
 }
 
@@ -1874,16 +3710,16 @@ throw RException(PyExc_SystemError, "Invalid jump.");
 }
 BAD_OP(STOP_CODE);
 
-BINARY_OP3(BINARY_MULTIPLY, PyNumber_Multiply, IntegerOps::mul, true);
-BINARY_OP3(BINARY_DIVIDE, PyNumber_Divide, IntegerOps::div, true);
-BINARY_OP3(BINARY_ADD, PyNumber_Add, IntegerOps::add, true);
-BINARY_OP3(BINARY_SUBTRACT, PyNumber_Subtract, IntegerOps::sub, true);
-BINARY_OP3(BINARY_OR, PyNumber_Or, IntegerOps::Or, false);
-BINARY_OP3(BINARY_XOR, PyNumber_Xor, IntegerOps::Xor, false);
-BINARY_OP3(BINARY_AND, PyNumber_And, IntegerOps::And, false);
-BINARY_OP3(BINARY_RSHIFT, PyNumber_Rshift, IntegerOps::Rshift, false);
-BINARY_OP3(BINARY_LSHIFT, PyNumber_Lshift, IntegerOps::Lshift, false);
-BINARY_OP2(BINARY_TRUE_DIVIDE, PyNumber_TrueDivide);
+NUMBER_OP3(BINARY_MULTIPLY, PyNumber_Multiply, IntegerOps::mul, FloatOps::mul);
+NUMBER_OP3(BINARY_DIVIDE, PyNumber_Divide, IntegerOps::div, FloatOps::div);
+NUMBER_OP3(BINARY_ADD, PyNumber_Add, IntegerOps::add, FloatOps::add);
+NUMBER_OP3(BINARY_SUBTRACT, PyNumber_Subtract, IntegerOps::sub, FloatOps::sub);
+BINARY_OP3(BINARY_OR, PyNumber_Or, IntegerOps::Or);
+BINARY_OP3(BINARY_XOR, PyNumber_Xor, IntegerOps::Xor);
+BINARY_OP3(BINARY_AND, PyNumber_And, IntegerOps::And);
+BINARY_OP3(BINARY_RSHIFT, PyNumber_Rshift, IntegerOps::Rshift);
+BINARY_OP3(BINARY_LSHIFT, PyNumber_Lshift, IntegerOps::Lshift);
+NUMBER_OP3(BINARY_TRUE_DIVIDE, PyNumber_TrueDivide, nullptr, FloatOps::div);
 BINARY_OP2(BINARY_FLOOR_DIVIDE, PyNumber_FloorDivide);
 
 DEFINE_OP(BINARY_POWER, BinaryPower);
@@ -1897,18 +3733,18 @@ DEFINE_OP(CONST_INDEX, ConstIndex);
 
 DEFINE_OP(DICT_CONTAINS, DictContains);
 
-BINARY_OP3(INPLACE_MULTIPLY, PyNumber_InPlaceMultiply, IntegerOps::mul, true);
-BINARY_OP3(INPLACE_DIVIDE, PyNumber_InPlaceDivide, IntegerOps::div, true);
-BINARY_OP3(INPLACE_ADD, PyNumber_InPlaceAdd, IntegerOps::add, true);
-BINARY_OP3(INPLACE_SUBTRACT, PyNumber_InPlaceSubtract, IntegerOps::sub, true);
-BINARY_OP3(INPLACE_MODULO, PyNumber_InPlaceRemainder, IntegerOps::mod, true);
+NUMBER_OP3(INPLACE_MULTIPLY, PyNumber_InPlaceMultiply, IntegerOps::mul, FloatOps::mul);
+NUMBER_OP3(INPLACE_DIVIDE, PyNumber_InPlaceDivide, IntegerOps::div, FloatOps::div);
+NUMBER_OP3(INPLACE_ADD, PyNumber_InPlaceAdd, IntegerOps::add, FloatOps::add);
+NUMBER_OP3(INPLACE_SUBTRACT, PyNumber_InPlaceSubtract, IntegerOps::sub, FloatOps::sub);
+BINARY_OP3(INPLACE_MODULO, PyNumber_InPlaceRemainder, IntegerOps::mod);
 
 BINARY_OP2(INPLACE_OR, PyNumber_InPlaceOr);
 BINARY_OP2(INPLACE_XOR, PyNumber_InPlaceXor);
 BINARY_OP2(INPLACE_AND, PyNumber_InPlaceAnd);
 BINARY_OP2(INPLACE_RSHIFT, PyNumber_InPlaceRshift);
 BINARY_OP2(INPLACE_LSHIFT, PyNumber_InPlaceLshift);
-BINARY_OP2(INPLACE_TRUE_DIVIDE, PyNumber_InPlaceTrueDivide);
+NUMBER_OP3(INPLACE_TRUE_DIVIDE, PyNumber_InPlaceTrueDivide, nullptr, FloatOps::div);
 BINARY_OP2(INPLACE_FLOOR_DIVIDE, PyNumber_InPlaceFloorDivide);
 DEFINE_OP(INPLACE_POWER, InplacePower);
 
@@ -1930,6 +3766,8 @@ DEFINE_OP(STORE_ATTR, StoreAttr);
 DEFINE_OP(STORE_SUBSCR, StoreSubscr);
 DEFINE_OP(STORE_SUBSCR_LIST, StoreSubscrList);
 DEFINE_OP(STORE_SUBSCR_DICT, StoreSubscrDict);
+DEFINE_OP(LOAD_METHOD, LoadMethod);
+CALL_OP(CALL_METHOD, CallMethod);
 
 DEFINE_OP(STORE_FAST, StoreFast);
 DEFINE_OP(STORE_SLICE, StoreSlice);
@@ -1948,6 +3786,8 @@ DEFINE_OP(FOR_ITER, ForIter);
 DEFINE_OP(BREAK_LOOP, BreakLoop);
 
 DEFINE_OP(BUILD_TUPLE, BuildTuple);
+DEFINE_OP(UNPACK_SEQUENCE, UnpackSequence);
+DEFINE_OP(UNPACK_RESULT, UnpackSequence);
 DEFINE_OP(BUILD_LIST, BuildList);
 DEFINE_OP(BUILD_MAP, BuildMap);
 DEFINE_OP(BUILD_SLICE, BuildSlice);
@@ -1957,10 +3797,10 @@ DEFINE_OP(PRINT_NEWLINE_TO, PrintNewline);
 DEFINE_OP(PRINT_ITEM, PrintItem);
 DEFINE_OP(PRINT_ITEM_TO, PrintItem);
 
-DEFINE_OP(CALL_FUNCTION, CallFunctionSimple);
-DEFINE_OP(CALL_FUNCTION_VAR, CallFunctionVar);
-DEFINE_OP(CALL_FUNCTION_KW, CallFunctionKw);
-DEFINE_OP(CALL_FUNCTION_VAR_KW, CallFunctionVarKw);
+CALL_OP(CALL_FUNCTION, CallFunctionSimple);
+CALL_OP(CALL_FUNCTION_VAR, CallFunctionVar);
+CALL_OP(CALL_FUNCTION_KW, CallFunctionKw);
+CALL_OP(CALL_FUNCTION_VAR_KW, CallFunctionVarKw);
 
 FALLTHROUGH(POP_JUMP_IF_FALSE);
 DEFINE_OP(JUMP_IF_FALSE_OR_POP, JumpIfFalseOrPop);
@@ -1980,6 +3820,11 @@ DEFINE_OP(IMPORT_STAR, ImportStar);
 DEFINE_OP(IMPORT_FROM, ImportFrom);
 DEFINE_OP(IMPORT_NAME, ImportName);
 
+DEFINE_OP(LOAD_EXCEPTION, LoadException);
+DEFINE_OP(FOR_ITER_PAIR, ForIterPair);
+DEFINE_OP(END_FINALLY, EndFinally);
+DEFINE_OP(RAISE_VARARGS, RaiseVarargs);
+
 DEFINE_OP(MAKE_FUNCTION, MakeFunction);
 DEFINE_OP(MAKE_CLOSURE, MakeClosure);
 DEFINE_OP(BUILD_CLASS, BuildClass);
@@ -1993,7 +3838,6 @@ BAD_OP(MAP_ADD);
 BAD_OP(SET_ADD);
 BAD_OP(EXTENDED_ARG);
 BAD_OP(SETUP_WITH);
-BAD_OP(RAISE_VARARGS);
 BAD_OP(DELETE_FAST);
 BAD_OP(SETUP_FINALLY);
 BAD_OP(SETUP_EXCEPT);
@@ -2001,10 +3845,7 @@ BAD_OP(CONTINUE_LOOP);
 BAD_OP(BUILD_SET);
 BAD_OP(DUP_TOPX);
 BAD_OP(DELETE_ATTR);
-BAD_OP(UNPACK_SEQUENCE);
 BAD_OP(DELETE_NAME);
-BAD_OP(END_FINALLY);
-BAD_OP(YIELD_VALUE);
 BAD_OP(EXEC_STMT);
 BAD_OP(WITH_CLEANUP);
 BAD_OP(PRINT_EXPR);
@@ -2019,15 +3860,50 @@ BAD_OP(ROT_TWO);
 BAD_OP(POP_TOP);
 
 } catch (RException &error) {
-  EVAL_LOG("ERROR: Leaving frame: %s", frame->str().c_str());
   if (error.exception != NULL) {
     PyErr_SetObject(error.exception, error.value);
   }
 
-  // TODO(power) - create a frame object here and attach it to the traceback.
-  PyFrameObject* py_frame = PyFrame_New(PyThreadState_GET(), frame->code->code(), frame->globals(), frame->locals());
-  PyTraceBack_Here(py_frame);
-  throw RException();
+  // Find a handler, unwinding the frames entered by calls from this loop;
+  // f belongs to our caller.
+  bool reraise = error.reraise;
+  int offset = frame->offset(pc);
+  int handler;
+  while (true) {
+    if (!reraise) {
+      // TODO(power) - create a frame object here and attach it to the traceback.
+      PyFrameObject* py_frame = PyFrame_New(PyThreadState_GET(), frame->code->code(), frame->globals(),
+                                            frame->locals());
+      if (py_frame != NULL) {
+        PyTraceBack_Here(py_frame);
+        Py_DECREF(py_frame);
+      }
+    }
+
+    handler = frame->code->find_handler(offset);
+    if (handler >= 0 || frame == f) {
+      break;
+    }
+
+    EVAL_LOG("ERROR: Leaving frame: %s", frame->str().c_str());
+    RegisterFrame* callee = frame;
+    frame = callee->return_frame_;
+    offset = frame->offset(callee->return_pc_) - 1;
+    pop_frame(callee);
+    Py_LeaveRecursiveCall();
+    reraise = false;
+  }
+
+  if (handler < 0) {
+    EVAL_LOG("ERROR: Leaving frame: %s", frame->str().c_str());
+    throw RException();
+  }
+
+  // LOAD_METHOD/CALL_METHOD pairs don't span blocks, so none are pending.
+  frame->method_bits_ = 0;
+  registers = frame->registers;
+  pc = frame->instructions() + handler;
+}
 }
 done: {
 //    EVAL_LOG("SUCCESS: Leaving frame: %s", frame->str().c_str());
@@ -86,26 +86,58 @@ struct SmallVector {
 
 typedef SmallVector<Register> ObjVector;
 
-struct Hint {
-  union {
-    PyObject* obj;
-    int dict_size;
-  } guard;
-
-  PyObject* key;
-  PyObject* value;
-  unsigned int version;
+// Registers and cells of all active frames of a thread are allocated from a
+// single stack made of large chunks; frames are strictly nested, so each
+// allocation is a pointer bump.  Chunks are never moved, so pointers into a
+// frame stay valid while it is live.
+class FrameStack: private boost::noncopyable {
+private:
+  static const size_t kChunkSize = 64 * 1024;
+
+  struct Chunk {
+    Register* base;
+    size_t size;
+    size_t used;
+  };
+
+  std::vector<Chunk> chunks_;
+  size_t top_;
+
+  void next_chunk(size_t n);
+
+public:
+  FrameStack();
+  ~FrameStack();
+
+  f_inline Register* push(size_t n) {
+    Chunk& c = chunks_[top_];
+    if (c.used + n > c.size) {
+      next_chunk(n);
+      return push(n);
+    }
+    Register* r = c.base + c.used;
+    c.used += n;
+    return r;
+  }
+
+  f_inline void pop(size_t n) {
+    Chunk& c = chunks_[top_];
+    c.used -= n;
+    if (c.used == 0 && top_ > 0) {
+      --top_;
+    }
+  }
+
+  // The stack for the calling thread.
+  static FrameStack* current();
 };
 
 struct RegisterFrame: private boost::noncopyable {
 public:
-#if STACK_ALLOC_REGISTERS
-  Register registers[kMaxRegisters];
-  PyObject* freevars[8];
-#else
+  // num_registers registers followed by num_cells cells.
   Register* registers;
   PyObject** freevars;
-#endif
+
   const RegisterCode* code;
 
   PyObject* builtins_;
@@ -116,6 +148,43 @@ public:
 
   const char* instructions_;
 
+  // One bit per pending LOAD_METHOD/CALL_METHOD pair, set when LOAD_METHOD
+  // left an unbound function and CALL_METHOD should pass self explicitly.
+  // Pairs never span basic blocks and nest at most kMaxMethodDepth deep.
+  uint64_t method_bits_;
+
+  // For frames entered by a call from the eval loop: the calling frame, and
+  // where to resume it and store the result once this frame returns.
+  RegisterFrame* return_frame_;
+  const char* return_pc_;
+  int return_reg_;
+
+  // Where eval() starts running this frame: the first instruction, or for a
+  // suspended generator, the one after the YIELD_VALUE which suspended it.
+  // yield_reg_ is that YIELD_VALUE's destination, which receives the value
+  // sent into the generator, or -1 if the frame isn't suspended.
+  const char* resume_pc_;
+  int yield_reg_;
+
+  // The thread's exception state from before this frame first handled an
+  // exception (exc_type_ is NULL until then), restored when it exits.
+  PyObject* exc_type_;
+  PyObject* exc_value_;
+  PyObject* exc_traceback_;
+
+  // Make an exception caught by this frame the one returned by sys.exc_info().
+  void set_exc_info(PyObject* type, PyObject* value, PyObject* tb);
+  void reset_exc_info();
+
+  f_inline void push_method_bit(bool unbound) {
+    method_bits_ = (method_bits_ << 1) | (unbound ? 1 : 0);
+  }
+
+  f_inline bool pop_method_bit() {
+    bool unbound = method_bits_ & 1;
+    method_bits_ >>= 1;
+    return unbound;
+  }
 
   f_inline const char* instructions() {
     return instructions_;
@@ -154,30 +223,65 @@ public:
 
   std::string str() const {
     StringWriter w;
-    if (code->function) {
-      PyFunctionObject* f = (PyFunctionObject*) code->function;
-      w.printf("func: %s ", obj_to_str(f->func_name));
-    }
     PyCodeObject* c = (PyCodeObject*) code->code_;
+    w.printf("func: %s ", obj_to_str(c->co_name));
     w.printf("file: %s, line: %d", obj_to_str(c->co_filename), c->co_firstlineno);
     return w.str();
   }
 
-  RegisterFrame(RegisterCode* func, PyObject* obj, const ObjVector& args, const ObjVector& kw);
+  // Set up a frame for calling obj (a function, bound method or code object).
+  // Callers then store the arguments directly into arg_slots(), bind any
+  // keyword arguments with bind_kwarg() and call bind_args() to fill in self,
+  // defaults and cells.
+  RegisterFrame(RegisterCode* func, PyObject* obj);
   ~RegisterFrame();
+
+  // Visit the references the frame owns, for the cyclic GC.
+  int traverse(visitproc visit, void* arg);
+
+  // Returns the registers for num_args positional arguments, which the
+  // caller must fill with new references.  Throws if the function can't
+  // accept that many, reporting the num_kwargs keyword arguments as given
+  // too; missing arguments are reported by bind_args().
+  Register* arg_slots(int num_args, int num_kwargs = 0);
+
+  // Binds value to parameter param (an index into co_varnames), which must
+  // not have been passed one of the num_args positional arguments.
+  void bind_kwarg(int num_args, int param, Register& value);
+  void bind_args(int num_args);
+
+  // The general form of binding, for calls passing *args or **kwargs and for
+  // functions taking them.  Positional arguments are the num_args registers
+  // at args, then the items of star (a tuple or list, or NULL); keyword
+  // arguments are the num_kwargs (name, value) register pairs at kwargs, then
+  // the items of the dict starstar (or NULL).  Arguments left over are packed
+  // into the function's *args and **kwargs parameters.  Also does bind_args().
+  void bind_call(Register* caller, const RegisterOffset* args, int num_args, const RegisterOffset* kwargs,
+                 int num_kwargs, PyObject* star, PyObject* starstar);
+
+private:
+  Register& kwarg_slot(int num_args, int param);
+  void bind_keyword(int num_args, PyObject* name, PyObject* value, PyObject* kwdict);
+
+  PyObject* function_;
+  PyObject* self_;
+  int num_slots_;
 };
 
 class Evaluator {
 public:
-  Hint hints[kMaxHints + 1];
+  // Inline cache statistics for attribute and global lookups and call sites.
+  int64_t attr_hits_;
+  int64_t attr_misses_;
+  int64_t global_hits_;
+  int64_t global_misses_;
+  int64_t call_hits_;
+  int64_t call_misses_;
 private:
   void collect_info(int opcode);
   int32_t op_counts_[256];
   int64_t op_times_[256];
 
-  int64_t hint_hits_;
-  int64_t hint_misses_;
-
   int32_t total_count_;
   int64_t last_clock_;
 
@@ -188,8 +292,19 @@ public:
   void dump_status();
 
   inline RegisterCode* compile(PyObject* f);
+  inline RegisterCode* compile_if_hot(PyObject* f);
+  inline unsigned long code_epoch();
+  inline bool is_compiled(PyObject* f);
+
+  // Number of functions loaded from the on-disk code cache.
+  inline long disk_cache_loads();
+
+  // Number of calls before a function is compiled instead of run by CPython.
+  void set_hot_threshold(int threshold);
 
-  Register eval(RegisterFrame* rf);
+  // Run rf from its resume pc.  If raise is set, the pending Python
+  // exception is raised there instead, as if by the suspending YIELD_VALUE.
+  Register eval(RegisterFrame* rf, bool raise = false);
   PyObject* eval_python(PyObject* func, PyObject* args, PyObject* kw);
 
   RegisterFrame* frame_from_pyframe(PyFrameObject*);
@@ -201,6 +316,22 @@ RegisterCode* Evaluator::compile(PyObject* obj) {
   return compiler_->compile(obj);
 }
 
+RegisterCode* Evaluator::compile_if_hot(PyObject* obj) {
+  return compiler_->compile_if_hot(obj);
+}
+
+bool Evaluator::is_compiled(PyObject* obj) {
+  return compiler_->is_compiled(obj);
+}
+
+long Evaluator::disk_cache_loads() {
+  return compiler_->disk_loads();
+}
+
+unsigned long Evaluator::code_epoch() {
+  return compiler_->epoch();
+}
+
 //void StartTracing(Evaluator*);
 //int TraceFunction(PyObject *obj, PyFrameObject *frame, int what, PyObject *arg);
 
@@ -11,6 +11,7 @@ RException::RException(PyObject* exc, const char* fmt, ...) :
   traceback = NULL;
   file = NULL;
   line = 0;
+  reraise = false;
 }
 
 RException::RException() {
@@ -18,5 +19,6 @@ RException::RException() {
   traceback = exception = value = NULL;
   file = NULL;
   line = 0;
+  reraise = false;
 }
 
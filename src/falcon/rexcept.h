@@ -13,6 +13,9 @@ struct RException {
   const char* file;
   int line;
 
+  // Re-raising an exception doesn't add the frame to its traceback again.
+  bool reraise;
+
   RException();
   RException(PyObject* exc, const char* fmt, ...);
 };
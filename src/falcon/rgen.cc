@@ -0,0 +1,268 @@
+#include "rgen.h"
+#include "reval.h"
+
+// Generators for compiled code; this follows genobject.c.
+
+PyObject* rgen_new(Evaluator* eval, RegisterFrame* frame) {
+  RGenObject* gen = PyObject_GC_New(RGenObject, &RGen_Type);
+  if (gen == NULL) {
+    delete frame;
+    throw RException();
+  }
+  gen->eval = eval;
+  gen->frame = frame;
+  gen->code = frame->code->code_;
+  Py_INCREF(gen->code);
+  gen->running = false;
+  PyObject_GC_Track(gen);
+  return (PyObject*) gen;
+}
+
+// Run the generator until it yields, returning the yielded value.  value is
+// the result of the YIELD_VALUE it was suspended at; if raise is set, the
+// pending exception is raised there instead.  Returns NULL without an
+// exception set if the generator returned.
+static n_inline PyObject* rgen_resume(RGenObject* gen, PyObject* value, bool raise) {
+  RegisterFrame* frame = gen->frame;
+  if (gen->running) {
+    PyErr_SetString(PyExc_ValueError, "generator already executing");
+    return NULL;
+  }
+  if (frame == NULL) {
+    return NULL;
+  }
+
+  if (frame->yield_reg_ >= 0) {
+    if (!raise) {
+      Register& r = frame->registers[frame->yield_reg_];
+      r.decref();
+      Py_INCREF(value);
+      r.store(value);
+    }
+    frame->yield_reg_ = -1;
+  } else if (value != Py_None && !raise) {
+    PyErr_SetString(PyExc_TypeError, "can't send non-None value to a just-started generator");
+    return NULL;
+  }
+
+  if (Py_EnterRecursiveCall(" in generator")) {
+    return NULL;
+  }
+
+  gen->running = true;
+  Register result;
+  bool failed = false;
+  try {
+    result = gen->eval->eval(frame, raise);
+  } catch (RException& e) {
+    failed = true;
+  }
+  gen->running = false;
+  Py_LeaveRecursiveCall();
+
+  if (!failed && frame->yield_reg_ >= 0) {
+    return result.as_obj();
+  }
+
+  // The generator returned (None) or raised; either way it is finished.
+  if (!failed) {
+    result.decref();
+  }
+  gen->frame = NULL;
+  delete frame;
+  return NULL;
+}
+
+PyObject* rgen_next(RGenObject* gen) {
+  PyObject* v = rgen_resume(gen, Py_None, false);
+  if (v == NULL && PyErr_ExceptionMatches(PyExc_StopIteration)) {
+    PyErr_Clear();
+  }
+  return v;
+}
+
+static PyObject* rgen_send(RGenObject* gen, PyObject* value) {
+  PyObject* v = rgen_resume(gen, value, false);
+  if (v == NULL && !PyErr_Occurred()) {
+    PyErr_SetNone(PyExc_StopIteration);
+  }
+  return v;
+}
+
+static PyObject* rgen_throw(RGenObject* gen, PyObject* args) {
+  PyObject* type;
+  PyObject* value = NULL;
+  PyObject* tb = NULL;
+  if (!PyArg_UnpackTuple(args, "throw", 1, 3, &type, &value, &tb)) {
+    return NULL;
+  }
+
+  if (tb == Py_None) {
+    tb = NULL;
+  } else if (tb != NULL && !PyTraceBack_Check(tb)) {
+    PyErr_SetString(PyExc_TypeError, "throw() third argument must be a traceback object");
+    return NULL;
+  }
+
+  Py_INCREF(type);
+  Py_XINCREF(value);
+  Py_XINCREF(tb);
+
+  if (PyExceptionClass_Check(type)) {
+    PyErr_NormalizeException(&type, &value, &tb);
+  } else if (PyExceptionInstance_Check(type)) {
+    if (value != NULL && value != Py_None) {
+      PyErr_SetString(PyExc_TypeError, "instance exception may not have a separate value");
+      goto failed;
+    }
+    Py_XDECREF(value);
+    value = type;
+    type = PyExceptionInstance_Class(type);
+    Py_INCREF(type);
+  } else {
+    PyErr_Format(PyExc_TypeError, "exceptions must be classes, or instances, not %s", Py_TYPE(type)->tp_name);
+    goto failed;
+  }
+
+  PyErr_Restore(type, value, tb);
+  return rgen_resume(gen, Py_None, true);
+
+failed:
+  Py_DECREF(type);
+  Py_XDECREF(value);
+  Py_XDECREF(tb);
+  return NULL;
+}
+
+static PyObject* rgen_close(RGenObject* gen, PyObject* args) {
+  if (gen->frame == NULL) {
+    Py_RETURN_NONE;
+  }
+
+  PyErr_SetNone(PyExc_GeneratorExit);
+  PyObject* v = rgen_resume(gen, Py_None, true);
+  if (v != NULL) {
+    Py_DECREF(v);
+    PyErr_SetString(PyExc_RuntimeError, "generator ignored GeneratorExit");
+    return NULL;
+  }
+  if (!PyErr_Occurred()) {
+    Py_RETURN_NONE;
+  }
+  if (PyErr_ExceptionMatches(PyExc_StopIteration) || PyErr_ExceptionMatches(PyExc_GeneratorExit)) {
+    PyErr_Clear();
+    Py_RETURN_NONE;
+  }
+  return NULL;
+}
+
+static void rgen_dealloc(RGenObject* gen) {
+  PyObject_GC_UnTrack(gen);
+  RegisterFrame* frame = gen->frame;
+  // A generator suspended in a try block is closed, so its except and
+  // finally clauses run.
+  if (frame != NULL && frame->yield_reg_ >= 0
+      && frame->code->find_handler(frame->offset(frame->resume_pc_) - 1) >= 0) {
+    // Temporarily resurrect the generator while close() runs.
+    PyObject_GC_Track(gen);
+    Py_REFCNT(gen) = 1;
+    PyObject* res = rgen_close(gen, NULL);
+    if (res == NULL) {
+      PyErr_WriteUnraisable((PyObject*) gen);
+    } else {
+      Py_DECREF(res);
+    }
+    if (--Py_REFCNT(gen) != 0) {
+      // close() stored a new reference to the generator somewhere.
+      return;
+    }
+    PyObject_GC_UnTrack(gen);
+  }
+
+  delete gen->frame;
+  Py_XDECREF(gen->code);
+  PyObject_GC_Del(gen);
+}
+
+static int rgen_traverse(RGenObject* gen, visitproc visit, void* arg) {
+  Py_VISIT(gen->code);
+  if (gen->frame != NULL) {
+    return gen->frame->traverse(visit, arg);
+  }
+  return 0;
+}
+
+// Breaks cycles through the frame.  A running generator's frame is in use by
+// the evaluator, so it is left alone.
+static int rgen_clear(RGenObject* gen) {
+  RegisterFrame* frame = gen->frame;
+  if (frame != NULL && !gen->running) {
+    gen->frame = NULL;
+    delete frame;
+  }
+  return 0;
+}
+
+static PyObject* rgen_repr(RGenObject* gen) {
+  return PyString_FromFormat("<falcon generator object at %p>", gen);
+}
+
+static PyObject* rgen_get_running(RGenObject* gen, void*) {
+  return PyBool_FromLong(gen->running);
+}
+
+static PyObject* rgen_get_code(RGenObject* gen, void*) {
+  Py_INCREF(gen->code);
+  return gen->code;
+}
+
+static PyObject* rgen_get_name(RGenObject* gen, void*) {
+  PyObject* name = ((PyCodeObject*) gen->code)->co_name;
+  Py_INCREF(name);
+  return name;
+}
+
+static PyGetSetDef rgen_getset[] = {
+  { (char*) "gi_running", (getter) rgen_get_running, NULL, NULL, NULL },
+  { (char*) "gi_code", (getter) rgen_get_code, NULL, NULL, NULL },
+  { (char*) "__name__", (getter) rgen_get_name, NULL, NULL, NULL },
+  { NULL, NULL, NULL, NULL, NULL }
+};
+
+static PyMethodDef rgen_methods[] = {
+  { "send", (PyCFunction) rgen_send, METH_O, NULL },
+  { "throw", (PyCFunction) rgen_throw, METH_VARARGS, NULL },
+  { "close", (PyCFunction) rgen_close, METH_NOARGS, NULL },
+  { NULL, NULL, 0, NULL }
+};
+
+PyTypeObject RGen_Type = {
+  PyVarObject_HEAD_INIT(&PyType_Type, 0) "falcon_generator", sizeof(RGenObject),
+  0,
+  (destructor)rgen_dealloc, /* tp_dealloc */
+  0, /* tp_print */
+  0, /* tp_getattr */
+  0, /* tp_setattr */
+  0, /* tp_compare */
+  (reprfunc)rgen_repr, /* tp_repr */
+  0, /* tp_as_number */
+  0, /* tp_as_sequence */
+  0, /* tp_as_mapping */
+  0, /* tp_hash */
+  0, /* tp_call */
+  0, /* tp_str */
+  PyObject_GenericGetAttr, /* tp_getattro */
+  0, /* tp_setattro */
+  0, /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC, /* tp_flags */
+  0, /* tp_doc */
+  (traverseproc)rgen_traverse, /* tp_traverse */
+  (inquiry)rgen_clear, /* tp_clear */
+  0, /* tp_richcompare */
+  0, /* tp_weaklistoffset */
+  PyObject_SelfIter, /* tp_iter */
+  (iternextfunc)rgen_next, /* tp_iternext */
+  rgen_methods, /* tp_methods */
+  0, /* tp_members */
+  rgen_getset, /* tp_getset */
+};
@@ -0,0 +1,34 @@
+#ifndef FALCON_RGEN_H
+#define FALCON_RGEN_H
+
+#include <Python.h>
+
+class Evaluator;
+struct RegisterFrame;
+
+// A generator running compiled code.  The generator owns a heap allocated
+// frame, which is suspended by each YIELD_VALUE and resumed by re-entering
+// the evaluator at the following instruction.
+typedef struct {
+  PyObject_HEAD
+  Evaluator* eval;
+  // NULL once the generator has finished.
+  RegisterFrame* frame;
+  // The code object, kept for gi_code after the frame is gone.
+  PyObject* code;
+  bool running;
+} RGenObject;
+
+extern PyTypeObject RGen_Type;
+
+#define RGen_CheckExact(op) (Py_TYPE(op) == &RGen_Type)
+
+// Returns a new generator which takes ownership of frame; its arguments must
+// already be bound.
+PyObject* rgen_new(Evaluator* eval, RegisterFrame* frame);
+
+// Resume the generator.  Like PyIter_Next, returns NULL without an exception
+// set once the generator is exhausted.
+PyObject* rgen_next(RGenObject* gen);
+
+#endif /* FALCON_RGEN_H */
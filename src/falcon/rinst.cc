@@ -68,3 +68,4 @@ template class RegOp<4> ;
 template class BranchOp<0> ;
 template class BranchOp<1> ;
 template class BranchOp<2> ;
+template class BranchOp<3> ;
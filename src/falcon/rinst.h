@@ -4,6 +4,7 @@
 #include "Python.h"
 
 #include <string>
+#include <vector>
 
 #include "oputil.h"
 #include "util.h"
@@ -53,37 +54,243 @@ static const int kMaxRegisters = 256;
 typedef uint8_t RegisterOffset;
 static const RegisterOffset kInvalidRegister = (RegisterOffset) -1;
 
+// Maximum nesting of LOAD_METHOD/CALL_METHOD pairs (see RegisterFrame::method_bits_).
+static const int kMaxMethodDepth = 64;
+
 
 
 
 typedef uint16_t JumpLoc;
 typedef void* JumpAddr;
 
-typedef uint8_t HintOffset;
-static const uint8_t kMaxHints = 223;
-static const uint8_t kInvalidHint = kMaxHints;
+// Operations which cache runtime information (see OpUtil::has_hint) are
+// assigned a private cache slot by the compiler.  The hint field of the
+// operation indexes into the cache array of the owning RegisterCode.
+typedef uint16_t HintOffset;
+static const HintOffset kInvalidHint = (HintOffset) -1;
+
+// Attribute lookups use a small polymorphic inline cache per call site.
+// Entries are guarded by the type of the object and the type's version
+// tag; CPython invalidates the tag whenever the type (or one of its bases)
+// is modified.
+static const int kAttrCacheEntries = 4;
+
+enum AttrCacheKind {
+  kAttrEmpty = 0,
+
+  // The attribute lives in the instance dictionary; we remember the
+  // slot it was found in and the size of the table.  STORE_ATTR sites
+  // use this kind for names without a data descriptor on the type.
+  kAttrDictSlot,
+
+  // A data descriptor on the type (property, __slots__ member, getset).
+  kAttrDataDescr,
+
+  // A non-data descriptor (functions, method descriptors) or plain class
+  // attribute which is not shadowed by the instance dictionary.
+  kAttrTypeValue
+};
+
+struct AttrCacheEntry {
+  PyTypeObject* type;
+  unsigned int version;
+  int kind;
+
+  Py_ssize_t dict_mask;
+  Py_ssize_t dict_slot;
+
+  // Borrowed; kept alive by the type dictionary for as long as the
+  // version tag is valid.
+  PyObject* descr;
+  descrgetfunc getter;
+};
+
+struct AttrCache {
+  AttrCacheEntry entries[kAttrCacheEntries];
+  int next_victim;
+};
+
+// LOAD_GLOBAL sites remember the dictionary entry the name was resolved
+// to.  The value is read from the live entry, so rebinding an existing
+// global needs no invalidation; the table/mask/key guards catch deletes
+// and resizes.  Names resolved in the builtins additionally depend on the
+// module globals not gaining the name, which is tracked by a watcher
+// installed on the globals dictionary (see dict_watch() in reval.cc).
+//
+// Each watched dictionary has an epoch, bumped whenever it gains a key and
+// when it starts being watched again.  A freed dictionary's record stays
+// behind, so caches also check that the dictionary is still watched.
+struct DictWatch {
+  unsigned long epoch;
+};
+
+struct GlobalCache {
+  PyDictObject* globals;
 
-static inline size_t hint_offset(void* obj, void* name) {
-  return ((size_t(obj) ^ size_t(name)) >> 4) % kMaxHints;
-}
+  // The dictionary the name was found in (globals or builtins).
+  PyDictObject* dict;
+  PyDictEntry* table;
+  Py_ssize_t mask;
+  PyDictEntry* entry;
+
+  bool in_builtins;
+  DictWatch* watch;
+  unsigned long watch_epoch;
+};
+
+// Call sites remember the last Python function called and the code compiled
+// for it; a NULL code means it couldn't be compiled, and is executed by
+// CPython.  Functions (and bound methods) are keyed on their code object, so
+// closures created from the same code share an entry.  The key is borrowed, so
+// the cache doesn't keep the callee's code (and its compiled code) alive; the
+// compiler's epoch, bumped when a compiled code object dies, says whether the
+// key and code are still valid.
+//
+// For calls with keyword arguments, kw_params holds the parameter each
+// keyword binds to, computed for the callee code kw_code.
+struct CallCache {
+  PyObject* callee;
+  unsigned long epoch;
+  struct RegisterCode* code;
+  struct RegisterCode* kw_code;
+  uint8_t* kw_params;
+};
+
+// An exception raised by an instruction at an offset in [start, end) is
+// handled by the code at handler.  The ranges of a function are disjoint.
+struct ExceptionHandler {
+  int32_t start;
+  int32_t end;
+  int32_t handler;
+};
 
 struct RegisterCode {
   int16_t num_registers;
   int16_t version;
   int16_t mapped_labels :1;
   int16_t mapped_registers :1;
-  int16_t reserved :14;
-
-  // The Python function object this code object was built from (NULL if
-  // compiled directly from a code object).
-  PyObject* function;
+  // Set for generator functions; their frames outlive the call which
+  // created them, so they are allocated on the heap.
+  int16_t generator :1;
+  // Set for functions taking *args or **kwargs.
+  int16_t varargs :1;
+  int16_t reserved :12;
 
   PyObject* code_;
 
+  // co_consts, extended with the constants folded while compiling.
+  PyObject* consts_;
+
   int16_t num_freevars;
   int16_t num_cellvars;
   int16_t num_cells;
 
+  uint16_t num_attr_caches;
+  AttrCache* attr_caches;
+
+  uint16_t num_global_caches;
+  GlobalCache* global_caches;
+
+  uint16_t num_call_caches;
+  CallCache* call_caches;
+
+  // The frame template: everything about setting up a frame which depends
+  // only on the code, computed once per code object.
+  //
+  // const_registers is the initial contents of a frame's registers and cells:
+  // the constants converted to registers, then cleared registers and cells.
+  // The template owns the constants' references; frames copy it without
+  // touching reference counts, and never release the first num_consts.
+  int16_t num_consts;
+  Register* const_registers;
+
+  // The constants stored unboxed.  Reading one as an object boxes it in the
+  // frame's register, so these are the only constants a frame may own.
+  int16_t num_unboxed_consts;
+  int16_t* unboxed_consts;
+
+  // For each cellvar, the parameter it is initialized from, or -1.
+  int16_t* cell_params;
+
+  // The builtins for the globals the code last ran with, resolved from their
+  // __builtins__ like CPython's frames do (see frame_builtins() in reval.cc).
+  // They are reused while the same globals dictionary hasn't gained a key.
+  PyObject* builtins;
+  PyObject* builtins_globals;
+  DictWatch* builtins_watch;
+  unsigned long builtins_epoch;
+
+  void init_frame_template(PyObject* consts) {
+    PyCodeObject* co = code();
+    Py_INCREF(consts);
+    consts_ = consts;
+    num_consts = PyTuple_GET_SIZE(consts);
+    const int num_slots = num_registers + num_cells;
+    const_registers = new Register[num_slots];
+    for (int i = 0; i < num_consts; ++i) {
+      PyObject* v = PyTuple_GET_ITEM(consts, i);
+      Py_INCREF(v);
+      const_registers[i].store(v);
+    }
+    for (int i = num_consts; i < num_slots; ++i) {
+      const_registers[i].reset();
+    }
+
+    num_unboxed_consts = 0;
+    unboxed_consts = new int16_t[num_consts];
+    for (int i = 0; i < num_consts; ++i) {
+      if (const_registers[i].boxed() == NULL) {
+        unboxed_consts[num_unboxed_consts++] = i;
+      }
+    }
+
+    const int num_named = co->co_argcount + ((co->co_flags & CO_VARARGS) ? 1 : 0)
+        + ((co->co_flags & CO_VARKEYWORDS) ? 1 : 0);
+    cell_params = new int16_t[num_cellvars];
+    for (int i = 0; i < num_cellvars; ++i) {
+      cell_params[i] = -1;
+      PyObject* name = PyTuple_GET_ITEM(co->co_cellvars, i);
+      for (int j = 0; j < num_named; ++j) {
+        if (_PyString_Eq(name, PyTuple_GET_ITEM(co->co_varnames, j))) {
+          cell_params[i] = j;
+          break;
+        }
+      }
+    }
+
+    builtins = NULL;
+    builtins_globals = NULL;
+    builtins_watch = NULL;
+    builtins_epoch = 0;
+  }
+
+  // Allocate the (empty) inline caches once the num_*_caches counts are set.
+  void alloc_caches() {
+    attr_caches = new AttrCache[num_attr_caches];
+    bzero(attr_caches, sizeof(AttrCache) * num_attr_caches);
+    global_caches = new GlobalCache[num_global_caches];
+    bzero(global_caches, sizeof(GlobalCache) * num_global_caches);
+    call_caches = new CallCache[num_call_caches];
+    bzero(call_caches, sizeof(CallCache) * num_call_caches);
+  }
+
+  ~RegisterCode() {
+    for (int i = 0; i < num_consts; ++i) {
+      const_registers[i].decref();
+    }
+    delete[] const_registers;
+    delete[] unboxed_consts;
+    delete[] cell_params;
+    Py_XDECREF(consts_);
+    Py_XDECREF(builtins);
+    delete[] attr_caches;
+    delete[] global_caches;
+    for (int i = 0; i < num_call_caches; ++i) {
+      delete[] call_caches[i].kw_params;
+    }
+    delete[] call_caches;
+  }
+
   PyCodeObject* code() const {
     return (PyCodeObject*) code_;
   }
@@ -97,10 +304,22 @@ struct RegisterCode {
   }
 
   PyObject* consts() const {
-    return code()->co_consts;
+    return consts_;
+  }
+
+  // Returns the handler offset for an exception raised by the instruction
+  // at offset, or -1 if the exception leaves the function.
+  int find_handler(int offset) const {
+    for (size_t i = 0; i < handlers.size(); ++i) {
+      if (offset >= handlers[i].start && offset < handlers[i].end) {
+        return handlers[i].handler;
+      }
+    }
+    return -1;
   }
 
   std::string instructions;
+  std::vector<ExceptionHandler> handlers;
 };
 
 #if PACK_INSTRUCTIONS
@@ -133,7 +352,7 @@ struct RegOp {
 
 #if GETATTR_HINTS
   // The hint field is used by certain operations to cache information
-  // at runtime.  It is default initialized to kInvalidHint;
+  // at runtime.  It is default initialized to kInvalidHint.
   HintOffset hint_pos;
 #endif
 
@@ -155,6 +374,11 @@ struct VarRegOp {
   // function calls
   uint16_t arg;
   uint8_t num_registers;
+
+#if GETATTR_HINTS
+  HintOffset hint_pos;
+#endif
+
   RegisterOffset reg[0];
 
   std::string str(Register* registers = NULL) const;
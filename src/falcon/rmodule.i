@@ -43,6 +43,10 @@ public:
   Evaluator();
   ~Evaluator();
   PyObject* eval_python(PyObject* func, PyObject* args, PyObject* kw);
+  void dump_status();
+  void set_hot_threshold(int threshold);
+  bool is_compiled(PyObject* function);
+  long disk_cache_loads();
 };
 
 
@@ -31,4 +31,75 @@ def inplace_add(x):
 def test_inplace_add():
   a = [0]
   inplace_add(a) 
-  
\ No newline at end of file
+  
+@wrap
+def float_kernel(n):
+  xs = [i * 0.5 for i in range(n)]
+  total = 0.0
+  scaled = 0.0
+  for x in xs:
+    total += x * x - x / 3.0
+    scaled = scaled * 0.5 + x
+  return total, scaled, total / n, 7 / 2.0, 1 - 0.5
+
+def test_float_kernel():
+  float_kernel(100)
+
+@wrap
+def float_ranges():
+  results = []
+  for x in (0.0, -0.0, 1.5, -2.25, 1e-300, 1e300, 1e77, 1e-77, float('inf'), float('nan')):
+    y = x * 2.0
+    z = y - x
+    results.append((repr(y), repr(z), repr(x / 4), z < 1.0, z >= x, x == x))
+  return results
+
+def test_float_ranges():
+  float_ranges()
+
+@wrap
+def mixed_compare(big):
+  f = float(big)
+  return big == f, big + 1 == f, big + 1 > f, f < big + 1, 2.0 * 3
+
+def test_mixed_compare():
+  mixed_compare(2 ** 53)
+
+@wrap
+def float_division_errors():
+  errors = []
+  for den in (0.0, 0, -0.0):
+    try:
+      1.5 / den
+    except ZeroDivisionError:
+      errors.append(True)
+    x = 2.0
+    try:
+      x /= den
+    except ZeroDivisionError:
+      errors.append(x)
+  return errors
+
+def test_float_division_errors():
+  float_division_errors()
+
+@wrap
+def int_overflow(a, b, s):
+  return (a * b, a * -b, -a * b, a + a, -a - a, a - -a, a << 30, a << 70, a >> 70, -a >> 70,
+          a << s, b * b * b)
+
+def test_int_overflow():
+  import sys
+  int_overflow(2 ** 40, 2 ** 40, 23)
+  int_overflow(3 ** 20, 3 ** 19, 1)
+  int_overflow(sys.maxint // 2 + 5, 3, 2)
+  int_overflow(sys.maxint, 62, 62)
+
+def test_boxed_int_identity():
+  import falcon
+  # A variable boxes its int once, so it stays the same object once it escapes.
+  def same(n):
+    x = n + 1000
+    ids = [id(x), id(x)]
+    return [x][0] is x, ids[0] == ids[1], id(x) == ids[0]
+  assert falcon.wrap(same)(5) == (True, True, True)
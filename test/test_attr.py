@@ -29,3 +29,191 @@ def store_load_attr(a,b):
 def test_store_load_attr():
   store_load_attr(0, 10)
 
+
+class WithProperty(object):
+  def __init__(self):
+    self._a = 1
+
+  @property
+  def a(self):
+    return self._a + 1
+
+class WithSlots(object):
+  __slots__ = ['a']
+  def __init__(self):
+    self.a = 2
+
+class WithClassAttr(object):
+  a = 3
+
+class WithMethod(object):
+  def a(self):
+    return 4
+
+@wrap
+def load_polymorphic(objs):
+  total = 0
+  for o in objs:
+    v = o.a
+    if callable(v):
+      v = v()
+    total += v
+  return total
+
+def test_load_polymorphic():
+  shadowed = WithClassAttr()
+  shadowed.a = 5
+  objs = [Foo(), WithProperty(), WithSlots(), WithClassAttr(), WithMethod(), shadowed]
+  objs[0].a = 0
+  load_polymorphic(objs * 3)
+
+@wrap
+def load_class_attr(objs):
+  return [o.a for o in objs]
+
+def test_class_attr_invalidation():
+  objs = [WithClassAttr() for i in range(5)]
+  load_class_attr(objs)
+  WithClassAttr.a = 10
+  load_class_attr(objs)
+  WithClassAttr.a = 3
+
+
+class Counter(object):
+  def __init__(self):
+    self.n = 0
+
+  def add(self, a, b=1):
+    self.n += a * b
+    return self.n
+
+def instance_fn(x):
+  return x + 1
+
+@wrap
+def call_methods(objs):
+  import math
+  c = Counter()
+  d = dict()
+  d['a'] = 1
+  total = 0
+  for o in objs:
+    total += c.add(o.a, c.add(1))
+    total += d.get('a') + d.get('b', 2) + len(d.keys())
+    total += int(math.sqrt(16))
+    total += len(', '.join(['x', 'y']).split(','))
+  c.fn = instance_fn
+  total += c.fn(1)
+  total += c.add(3, b=2)
+  return total
+
+def test_call_methods():
+  objs = [Foo(), WithSlots(), WithClassAttr()]
+  objs[0].a = 0
+  call_methods(objs * 3)
+
+
+class WithSetter(object):
+  def __init__(self):
+    self._a = 0
+
+  def get_a(self):
+    return self._a
+
+  def set_a(self, v):
+    self._a = v * 2
+
+  a = property(get_a, set_a)
+
+@wrap
+def store_polymorphic(objs):
+  total = []
+  for i, o in enumerate(objs):
+    o.a = i
+    o.a = o.a + 1
+    total.append(o.a)
+  return total
+
+def test_store_polymorphic():
+  make = lambda: [Foo(), WithSlots(), WithSetter(), WithClassAttr(), object.__new__(Foo)]
+  store_polymorphic(make() * 3)
+
+class Record(object):
+  def __init__(self, a, b, c):
+    self.a = a
+    self.b = b
+    self.c = c
+
+@wrap
+def build_records(n):
+  records = []
+  for i in range(n):
+    r = Record(i, [i], str(i))
+    r.b = r.a + 1
+    records.append(r)
+  return [(r.a, r.b, r.c, sorted(r.__dict__.items())) for r in records]
+
+def test_build_records():
+  build_records(50)
+
+class Cursor(object):
+  def __init__(self, idx):
+    self.idx = idx
+
+@wrap
+def repeated_loads(items, idx):
+  # The loads after the stores must see them.
+  x = list(items)
+  c = Cursor(idx)
+  a = x[c.idx] + x[c.idx]
+  c.idx += 1
+  b = x[c.idx] * 2
+  x[c.idx] = 10
+  if a > 0:
+    b += x[c.idx]
+  else:
+    b -= x[c.idx]
+  return a, b, c.idx
+
+def test_repeated_loads():
+  repeated_loads([1, 2, 3, 4], 0)
+  repeated_loads([-1, 2, 3, 4], 0)
+
+class Ticker(object):
+  def __init__(self):
+    self.n = 0
+
+  @property
+  def tick(self):
+    self.n += 1
+    return self.n
+
+@wrap
+def read_property_twice():
+  o = Ticker()
+  a = o.tick
+  b = o.tick
+  return a, b
+
+def test_read_property_twice():
+  read_property_twice()
+
+class Mutator(object):
+  def __init__(self, target):
+    self.target = target
+
+  def __add__(self, other):
+    self.target[0] += other
+    return self
+
+@wrap
+def load_after_operator():
+  x = [1]
+  ad = Mutator(x)
+  a = x[0]
+  ad + 1
+  b = x[0]
+  return a, b
+
+def test_load_after_operator():
+  load_after_operator()
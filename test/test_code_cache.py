@@ -0,0 +1,100 @@
+import os
+import shutil
+import tempfile
+
+import falcon
+
+SOURCE = '''
+def f(n):
+  total = 0
+  step = 2
+  name = 'a' + 'b'
+  for i in range(n):
+    total += i * step
+  return total, name * step
+'''
+
+def make_function():
+  ns = {}
+  exec compile(SOURCE, '<test_code_cache>', 'exec') in ns
+  return ns['f']
+
+def test_disk_cache():
+  cache_dir = tempfile.mkdtemp()
+  os.environ['FALCON_CACHE_DIR'] = cache_dir
+  try:
+    # The first function compiles and fills the cache, the second is
+    # built from a distinct but identical code object and is loaded.
+    loads = falcon.evaluator.disk_cache_loads()
+    assert falcon.wrap(make_function())(10) == (90, 'abab')
+    assert falcon.evaluator.disk_cache_loads() == loads
+    files = os.listdir(cache_dir)
+    assert len(files) == 1
+    path = os.path.join(cache_dir, files[0])
+    before = os.stat(path)
+
+    assert falcon.wrap(make_function())(20) == (380, 'abab')
+    assert falcon.evaluator.disk_cache_loads() == loads + 1
+    assert os.listdir(cache_dir) == files
+    after = os.stat(path)
+    assert (after.st_ino, after.st_mtime) == (before.st_ino, before.st_mtime)
+  finally:
+    del os.environ['FALCON_CACHE_DIR']
+    shutil.rmtree(cache_dir)
+
+def test_disk_cache_corrupt_header():
+  import struct
+  cache_dir = tempfile.mkdtemp()
+  os.environ['FALCON_CACHE_DIR'] = cache_dir
+  try:
+    assert falcon.wrap(make_function())(10) == (90, 'abab')
+    path = os.path.join(cache_dir, os.listdir(cache_dir)[0])
+    data = open(path, 'rb').read()
+    num_handlers, = struct.unpack_from('<h', data, 30)
+    instructions_size, consts_size = struct.unpack_from('<QQ', data, 32)
+
+    # Sizes which only add up to the file size once they wrap around.
+    wrapped = [
+      (num_handlers, instructions_size + 2 ** 63, consts_size + 2 ** 63),
+      (-1, instructions_size + (num_handlers + 1) * 12, consts_size),
+    ]
+    for handlers, instructions, consts in wrapped:
+      header = struct.pack('<hQQ', handlers, instructions % 2 ** 64, consts % 2 ** 64)
+      with open(path, 'wb') as f:
+        f.write(data[:30] + header + data[48:])
+      loads = falcon.evaluator.disk_cache_loads()
+      assert falcon.wrap(make_function())(20) == (380, 'abab')
+      assert falcon.evaluator.disk_cache_loads() == loads
+  finally:
+    del os.environ['FALCON_CACHE_DIR']
+    shutil.rmtree(cache_dir)
+
+def test_disk_cache_warning_flags():
+  import ctypes
+  flag = ctypes.c_int.in_dll(ctypes.pythonapi, 'Py_DivisionWarningFlag')
+  source = 'def f():\n  return 7 / 2\n'
+  def make():
+    ns = {}
+    exec compile(source, '<test_code_cache>', 'exec') in ns
+    return ns['f']
+
+  cache_dir = tempfile.mkdtemp()
+  os.environ['FALCON_CACHE_DIR'] = cache_dir
+  saved = flag.value
+  try:
+    # Code folded without -Qwarn must not be reused once it is set.
+    flag.value = 0
+    assert falcon.wrap(make())() == 3
+    loads = falcon.evaluator.disk_cache_loads()
+    flag.value = 1
+    assert falcon.wrap(make())() == 3
+    assert falcon.evaluator.disk_cache_loads() == loads
+    assert len(os.listdir(cache_dir)) == 2
+  finally:
+    flag.value = saved
+    del os.environ['FALCON_CACHE_DIR']
+    shutil.rmtree(cache_dir)
+
+if __name__ == '__main__':
+  import nose
+  nose.main()
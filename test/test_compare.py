@@ -25,4 +25,84 @@ def test_compare_tuples():
 def test_compare_strings():
   compare("hello", "hello")
   compare("hello", "hello2")
-  compare("hello", "hell")
\ No newline at end of file
+  compare("hello", "hell")
+@wrap
+def compare_results(n):
+  flags = []
+  count = 0
+  for i in range(n):
+    small = i < 5
+    flags.append(small)
+    count += small
+    if not small and i % 2:
+      count += 10
+  return flags, count, flags[0] is True, (3 > 2) + 1, not 0.5, 1.5 < 2 and i > 0 and None
+
+def test_compare_results():
+  compare_results(10)
+
+class Falsy(object):
+  def __nonzero__(self):
+    return False
+
+class BadTruth(object):
+  def __nonzero__(self):
+    raise ValueError('no truth value')
+
+@wrap
+def truth_values():
+  results = []
+  for v in (0, 1, -1, 0.0, 2.5, '', 'a', None, [], [0], Falsy()):
+    if v:
+      results.append(True)
+    else:
+      results.append(False)
+    results.append(not v)
+  try:
+    if BadTruth():
+      results.append(1)
+  except ValueError:
+    results.append(2)
+  return results
+
+def test_truth_values():
+  truth_values()
+
+@wrap
+def and_or_values(a, b):
+  x = a and b
+  y = a or b
+  return x, y, a, b, a and None, b or None, a < 1 or b
+
+def test_and_or_values():
+  and_or_values(0, 2)
+  and_or_values(3, 0)
+  and_or_values(3, 4)
+
+@wrap
+def constant_branches(n):
+  debug = 0
+  scale = 3
+  limit = scale * 4 + 1
+  name = 'ab' + 'cd'
+  items = (scale, limit, name)
+  out = []
+  for i in range(n):
+    if debug:
+      out.append('debug')
+    if not debug and scale > 2:
+      out.append(i * limit)
+    if limit in items and name[1:3] == 'bc':
+      out.append(items[-1][::2])
+    if i:
+      scale = i
+    out.append((scale < limit, -scale, ~limit, scale ** 2, name * 2, 7 / 2, 7 // 2.0, 1 << 70))
+  try:
+    out.append(limit / (scale - scale))
+  except ZeroDivisionError:
+    out.append('zero')
+  return out, u'a' == 'a', 'x' < u'y', (1, 2) is (1, 2), `limit`
+
+def test_constant_branches():
+  constant_branches(0)
+  constant_branches(3)
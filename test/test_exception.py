@@ -18,3 +18,132 @@ def capture(x):
 
 def test_exceptions():
   capture( (0,) )
+
+def test_caught_in_callee():
+  capture( (0,) * 200 )
+
+@wrap
+def except_match(x):
+  try:
+    return x[5]
+  except KeyError:
+    return 'key'
+  except IndexError as e:
+    return str(e)
+
+def test_except_match():
+  except_match((1, 2))
+  except_match(range(10))
+
+@wrap
+def except_in_loop(n):
+  total = 0
+  for i in range(n):
+    try:
+      total += 10 / (i % 3)
+    except ZeroDivisionError:
+      total += 1
+      continue
+    if total > 50:
+      break
+  return total
+
+def test_except_in_loop():
+  except_in_loop(30)
+
+@wrap
+def nested_except(x):
+  try:
+    try:
+      x[10]
+    except IndexError:
+      x['a']
+  except TypeError:
+    return 'outer'
+  return 'none'
+
+def test_nested_except():
+  nested_except([1])
+
+def cleanup(log, fail):
+  try:
+    log.append('body')
+    if fail:
+      log[100]
+    log.append('after')
+  finally:
+    log.append('finally')
+
+@wrap
+def finally_blocks():
+  log = []
+  cleanup(log, False)
+  try:
+    cleanup(log, True)
+  except IndexError:
+    log.append('caught')
+  return log
+
+def test_finally():
+  finally_blocks()
+
+class Failure(Exception):
+  pass
+
+@wrap
+def raise_forms(kind):
+  try:
+    if kind == 0:
+      raise Failure
+    elif kind == 1:
+      raise Failure('message')
+    elif kind == 2:
+      raise Failure, 'value'
+    else:
+      try:
+        raise ValueError('inner')
+      except ValueError:
+        raise
+  except Exception as e:
+    return (type(e).__name__, str(e))
+
+def test_raise():
+  for kind in range(4):
+    raise_forms(kind)
+
+@wrap
+def exc_info():
+  import sys
+  try:
+    {}[1]
+  except KeyError:
+    return sys.exc_info()[0].__name__
+
+def test_exc_info():
+  exc_info()
+
+def test_uncaught_raise():
+  import falcon
+  def fail(x):
+    raise Failure(x)
+  try:
+    falcon.wrap(fail)(3)
+    assert False
+  except Failure as e:
+    assert e.args == (3,)
+
+def long_function(n):
+  # Far more temporaries than a frame has registers, which only fit once
+  # they share registers.
+  lines = ['def f(xs):', '  total = 0', '  try:']
+  for i in range(n):
+    lines.append('    total += xs[%d] * 2 + xs[%d]' % (i % 7, (i + 1) % 7))
+  lines += ['  except IndexError:', '    total = -1', '  return total']
+  scope = {}
+  exec '\n'.join(lines) in scope
+  return wrap(scope['f'])
+
+def test_long_function():
+  f = long_function(150)
+  f(range(7))
+  f(range(3))
@@ -10,6 +10,15 @@ def test_nested():
   nested(3)
   nested(3.0)
   nested([1])
+
+@wrap
+def copy_then_reassign(a):
+  b = a
+  a = 5
+  return a, b
+
+def test_copy_then_reassign():
+  copy_then_reassign(3)
   
 @wrap   
 def nested_closure(x):
@@ -33,6 +42,318 @@ def test_nested_closure_repeat():
   nested_closure_repeat()
   
 
+def add_one(x):
+  return x + 1
+
+def add_two(x):
+  return x + 2
+
+class Box(object):
+  def __init__(self, x):
+    self.x = x
+
+  def __eq__(self, other):
+    return self.x == other.x
+
+@wrap
+def call_site_callees(fns):
+  results = []
+  for i, f in enumerate(fns):
+    results.append(f(i))
+  return results
+
+def test_call_site_callees():
+  call_site_callees([add_one, add_one, add_two, abs, Box, add_one, str, add_two] * 3)
+
+
+@wrap
+def closures_in_loop(n):
+  total = 0
+  for i in range(n):
+    def f(x):
+      return x + i
+    total += f(i)
+  return total
+
+def test_closures_in_loop():
+  closures_in_loop(20)
+
+def test_code_freed():
+  import falcon
+  for i in range(10):
+    ns = {}
+    exec compile('def f(x):\n  return x * %d\n' % i, '<test>', 'exec') in ns
+    assert falcon.wrap(ns['f'])(3) == 3 * i
+    del ns
+
+def test_callee_code_freed():
+  import gc, weakref
+  import falcon
+  ns = {}
+  exec 'def callee(x):\n  return x + 1\ndef caller(x):\n  return callee(x)\n' in ns
+  caller = falcon.wrap(ns['caller'])
+  assert caller(1) == 2
+  # The call site cache mustn't keep the old callee's code alive.
+  code = weakref.ref(ns['callee'].func_code)
+  exec 'def callee(x):\n  return x + 2\n' in ns
+  gc.collect()
+  assert code() is None
+  assert caller(1) == 3
+
+
+def test_hot_threshold():
+  import falcon
+  def cold(x):
+    return x * 2
+  def add_cold(n):
+    total = 0
+    for i in range(n):
+      total += cold(i)
+    return total
+  # Tiering applies to calls made by compiled code.
+  def call(f, x):
+    return f(x)
+  falcon.evaluator.set_hot_threshold(5)
+  try:
+    c = falcon.wrap(call)
+    for i in range(4):
+      assert c(cold, i) == i * 2
+      assert not falcon.evaluator.is_compiled(cold)
+    assert c(cold, 4) == 8
+    assert falcon.evaluator.is_compiled(cold)
+
+    # A call to code with one loop counts as five calls.
+    falcon.evaluator.set_hot_threshold(10)
+    def loop(n):
+      total = 0
+      for i in range(n):
+        total += i
+      return total
+    assert c(loop, 10) == 45
+    assert not falcon.evaluator.is_compiled(loop)
+    assert c(loop, 10) == 45
+    assert falcon.evaluator.is_compiled(loop)
+
+    assert falcon.wrap(add_cold)(20) == add_cold(20)
+  finally:
+    falcon.evaluator.set_hot_threshold(1)
+
+def test_explicit_call_compiles():
+  import falcon
+  def once(x):
+    return x + 1
+  falcon.evaluator.set_hot_threshold(10)
+  try:
+    assert falcon.wrap(once)(1) == 2
+    assert falcon.evaluator.is_compiled(once)
+  finally:
+    falcon.evaluator.set_hot_threshold(1)
+
+
+def with_defaults(a, b=1, c=2):
+  return (a, b, c)
+
+@wrap
+def call_with_defaults():
+  return [with_defaults(0), with_defaults(0, 5), with_defaults(0, 5, 6)]
+
+def test_call_with_defaults():
+  call_with_defaults()
+
+@wrap
+def many_cells(a, b):
+  c, d, e, f, g, h, i, j = range(8)
+  def inner():
+    return a + b + c + d + e + f + g + h + i + j
+  return inner()
+
+def test_many_cells():
+  many_cells(1, 2)
+
+def depth(n):
+  if n == 0:
+    return 0
+  return depth(n - 1) + 1
+
+@wrap
+def deep_recursion(n):
+  return depth(n)
+
+def test_deep_recursion():
+  deep_recursion(500)
+
+def unwind(n):
+  if n == 0:
+    return [][1]
+  return unwind(n - 1)
+
+def test_unwind_nested_calls():
+  import falcon
+  f = falcon.wrap(unwind)
+  for i in range(3):
+    try:
+      f(20)
+      assert False
+    except IndexError:
+      pass
+  deep_recursion(500)
+
+def test_recursion_limit():
+  import falcon
+  try:
+    falcon.wrap(depth)(100000)
+    assert False
+  except RuntimeError:
+    pass
+  deep_recursion(500)
+
+def scale(x, factor=2, offset=0):
+  return x * factor + offset
+
+class Point(object):
+  def __init__(self, x, y=0):
+    self.x = x
+    self.y = y
+
+  def moved(self, dx=0, dy=0):
+    return Point(self.x + dx, y=self.y + dy)
+
+@wrap
+def keyword_calls(n):
+  total = 0
+  for i in range(n):
+    total += scale(i, offset=1) + scale(x=i, factor=3) + scale(i, 4, offset=i)
+    p = Point(i, y=2).moved(dy=i)
+    total += p.x + p.y
+  return total
+
+def test_keyword_calls():
+  keyword_calls(10)
+
+@wrap
+def keyword_errors():
+  errors = []
+  for call in (lambda: scale(1, x=2), lambda: scale(1, scale=2), lambda: scale(factor=2)):
+    try:
+      call()
+    except TypeError:
+      errors.append(True)
+  return errors
+
+def test_keyword_errors():
+  keyword_errors()
+
+def no_args():
+  return 0
+
+def one_arg(a):
+  return a
+
+def rest_args(a, *rest):
+  return a
+
+@wrap
+def argument_error_messages():
+  # The messages must read like CPython's.
+  messages = []
+  for call in (lambda: no_args(1), lambda: no_args(*[1, 2]), lambda: one_arg(), lambda: one_arg(1, 2),
+               lambda: one_arg(1, a=2), lambda: one_arg(b=1), lambda: scale(), lambda: scale(1, 2, 3, 4),
+               lambda: scale(factor=2), lambda: scale(1, 2, 3, x=4), lambda: scale(*[1, 2, 3, 4]),
+               lambda: scale(1, **dict(bad=2)), lambda: rest_args(), lambda: Point(), lambda: Point(1).moved(1, 2, 3)):
+    try:
+      call()
+    except TypeError, e:
+      messages.append(str(e))
+  return messages
+
+def test_argument_error_messages():
+  argument_error_messages()
+
+def test_wrap_argument_error_messages():
+  import falcon
+  for fn, args, kw in ((no_args, (1,), {}), (one_arg, (), {}), (scale, (1, 2, 3, 4), {}),
+                       (scale, (), {'factor': 2}), (rest_args, (), {})):
+    try:
+      fn(*args, **kw)
+      assert False
+    except TypeError, e:
+      expected = str(e)
+    try:
+      falcon.wrap(fn)(*args, **kw)
+      assert False
+    except TypeError, e:
+      assert str(e) == expected, (str(e), expected)
+
+def logged(fn):
+  def wrapper(*args, **kw):
+    return fn(*args, **kw)
+  return wrapper
+
+@logged
+def logged_scale(x, factor=2, offset=0):
+  return x * factor + offset
+
+def collect(first, *rest, **options):
+  return (first, rest, sorted(options.items()))
+
+class Log(object):
+  def __init__(self):
+    self.lines = []
+
+  def write(self, *parts):
+    self.lines.append(parts)
+    return len(parts)
+
+@wrap
+def star_calls(n):
+  total = 0
+  args = (1, 2)
+  options = dict(offset=3)
+  log = Log()
+  for i in range(n):
+    total += logged_scale(i) + logged_scale(i, offset=1) + logged_scale(*args) + scale(i, **options)
+    total += scale(*[i, 3], **options) + log.write(i, i) + log.write()
+  return total, collect(1), collect(1, 2, *args, a=1, **options), log.lines
+
+def test_star_calls():
+  star_calls(10)
+
+def star_cells(*args, **kw):
+  return lambda: (args, kw)
+
+@wrap
+def star_errors():
+  errors = []
+  for call in (lambda: scale(*1), lambda: scale(**[]), lambda: scale(1, *(2, 3, 4)),
+               lambda: scale(1, x=1, **dict(x=2)), lambda: collect(1, first=2),
+               lambda: scale(1, offset=1, **dict(offset=2))):
+    try:
+      call()
+    except TypeError:
+      errors.append(True)
+  return errors, star_cells(1, a=2)()
+
+def test_star_errors():
+  star_errors()
+
+def test_wrap_keywords():
+  import falcon
+  f = falcon.wrap(scale)
+  assert f(3, offset=1) == 7
+  assert f(x=3, factor=1) == 3
+  try:
+    f(3, bad=1)
+    assert False
+  except TypeError:
+    pass
+
+def test_wrap_star_args():
+  import falcon
+  f = falcon.wrap(collect)
+  assert f(1, 2, 3, a=4) == (1, (2, 3), [('a', 4)])
+  assert f(*(1, 2), **{'b': 5}) == (1, (2,), [('b', 5)])
+
+
 if __name__ == '__main__':
   import nose 
   nose.main()
\ No newline at end of file
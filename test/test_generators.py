@@ -5,5 +5,153 @@ from testing_helpers import wrap
 def count_threshold_generator(limit, threshold):
   return sum(item > threshold for item in xrange(limit))
 
-#def test_count_threshold_generator():
-#  count_threshold_generator(1000,490)
\ No newline at end of file
+def test_count_threshold_generator():
+  count_threshold_generator(1000,490)
+
+def squares(n):
+  for i in range(n):
+    yield i * i
+
+@wrap
+def pipeline(n):
+  total = 0
+  for x in squares(n):
+    if x % 2 == 0:
+      total += x
+  return total, list(squares(n / 2))
+
+def test_pipeline():
+  pipeline(100)
+
+def accumulate():
+  total = 0
+  while True:
+    x = yield total
+    if x is None:
+      break
+    total += x
+
+@wrap
+def send_values(n):
+  g = accumulate()
+  g.next()
+  results = [g.send(i) for i in range(n)]
+  try:
+    g.next()
+  except StopIteration:
+    results.append('done')
+  return results
+
+def test_send_values():
+  send_values(10)
+
+def guarded(log):
+  try:
+    yield 1
+    yield 2
+  except ValueError:
+    log.append('caught')
+    yield 3
+  finally:
+    log.append('closed')
+
+def abandon(log):
+  g = guarded(log)
+  log.append(g.next())
+
+@wrap
+def throw_and_close():
+  log = []
+  g = guarded(log)
+  log.append(g.next())
+  log.append(g.throw(ValueError))
+  g.close()
+  g.close()
+
+  # Freeing a suspended generator closes it.
+  abandon(log)
+  return log
+
+def test_throw_and_close():
+  throw_and_close()
+
+def failing(n):
+  for i in range(n):
+    yield 10 / (n - i - 1)
+
+@wrap
+def generator_error(n):
+  seen = []
+  try:
+    for x in failing(n):
+      seen.append(x)
+  except ZeroDivisionError:
+    seen.append('error')
+  return seen
+
+def test_generator_error():
+  generator_error(5)
+
+def test_generator_outlives_function():
+  import gc
+  import falcon
+  ns = {'X': 3}
+  exec 'def g(n):\n  for i in range(n):\n    yield i * X\n' in ns
+  wrapped = falcon.wrap(ns['g'])
+  gen = wrapped(5)
+  del ns, wrapped
+  gc.collect()
+  garbage = [object() for i in range(1000)]
+  assert list(gen) == [0, 3, 6, 9, 12]
+
+def self_referencing(box):
+  box.append((yield 1))
+  yield 2
+
+def test_generator_cycle_collected():
+  import gc, weakref
+  import falcon
+  class Sentinel(object):
+    pass
+  box = [Sentinel()]
+  gen = falcon.wrap(self_referencing)(box)
+  gen.next()
+  gen.send(gen)
+  ref = weakref.ref(box[0])
+  del box, gen
+  gc.collect()
+  assert ref() is None
+
+def holds_self(sentinel):
+  me = yield 1
+  yield me
+  yield sentinel
+
+def test_generator_self_cycle_collected():
+  import gc, sys
+  import falcon
+  # Nothing but the generator is in the cycle, so it has to break it.
+  sentinel = object()
+  refs = sys.getrefcount(sentinel)
+  gen = falcon.wrap(holds_self)(sentinel)
+  gen.next()
+  assert gen.send(gen) is gen
+  del gen
+  gc.collect()
+  assert sys.getrefcount(sentinel) == refs
+
+def reports_running(box):
+  yield box[0].gi_running
+
+def test_generator_attributes():
+  import falcon
+  box = []
+  gen = falcon.wrap(reports_running)(box)
+  box.append(gen)
+  assert gen.__name__ == 'reports_running'
+  assert gen.gi_code is reports_running.func_code
+  assert not gen.gi_running
+  assert list(gen) == [True]
+  assert not gen.gi_running
+  assert gen.gi_code is reports_running.func_code
+  del box[:]
@@ -0,0 +1,100 @@
+from testing_helpers import wrap
+
+SCALE = 2
+
+@wrap
+def read_global(n):
+  total = 0
+  for i in xrange(n):
+    total += SCALE
+  return total
+
+def test_rebind_global():
+  global SCALE
+  read_global(10)
+  SCALE = 3
+  read_global(10)
+  SCALE = 2
+
+@wrap
+def call_builtin(l):
+  return len(l)
+
+def test_shadow_builtin():
+  global len
+  call_builtin([1, 2, 3])
+  len = lambda x: 42
+  try:
+    call_builtin([1, 2, 3])
+  finally:
+    del len
+  call_builtin([1, 2, 3])
+
+def set_scale(value):
+  global SCALE
+  SCALE = value
+
+@wrap
+def reread_global():
+  before = SCALE + SCALE
+  set_scale(SCALE + 1)
+  after = SCALE
+  set_scale(SCALE - 1)
+  return before, after
+
+def test_reread_after_call():
+  reread_global()
+
+@wrap
+def missing_global():
+  return NOT_DEFINED_YET
+
+def test_define_later():
+  global NOT_DEFINED_YET
+  try:
+    missing_global()
+    assert False, 'Expected NameError.'
+  except NameError:
+    pass
+  NOT_DEFINED_YET = 1
+  missing_global()
+  del NOT_DEFINED_YET
+
+def test_watched_namespace_freed():
+  import gc, weakref
+  import falcon
+  class Sentinel(object):
+    pass
+  ns = {'s': Sentinel()}
+  exec 'def count(l):\n  return len(l)\n' in ns
+  assert falcon.wrap(ns['count'])([1, 2]) == 2
+  ref = weakref.ref(ns['s'])
+  del ns
+  gc.collect()
+  assert ref() is None, 'Namespace kept alive by its builtins watch.'
+  # Dictionaries allocated in its place must not look watched.
+  for i in xrange(100):
+    d = {}
+    d['len'] = i
+  assert call_builtin.falcon_fn([1, 2, 3]) == 3
+
+def test_namespace_reallocated():
+  import falcon, types
+  def count(l):
+    return len(l)
+  # Fresh namespaces tend to land where the previous one was freed; a
+  # shadowing 'len' added before the call must still be seen.
+  for i in xrange(20):
+    ns = {'__builtins__': __builtins__}
+    if i % 2:
+      ns['len'] = lambda l: -1
+    f = types.FunctionType(count.func_code, ns)
+    assert falcon.wrap(f)([1, 2]) == (-1 if i % 2 else 2)
+    del f, ns
+
+def test_builtins_from_globals():
+  import falcon
+  ns = {'__builtins__': {'len': lambda l: 42}}
+  exec 'def count(l):\n  return len(l)\n' in ns
+  assert falcon.wrap(ns['count'])([1, 2]) == 42
+  assert call_builtin.falcon_fn([1, 2, 3]) == 3
@@ -10,4 +10,108 @@ def count_threshold(limit, threshold):
 def test_count_threshold():
   count_threshold(1000, 50)
   
-  
\ No newline at end of file
+  
+@wrap
+def range_loops(n):
+  out = []
+  for i in xrange(n): out.append(i)
+  for i in xrange(n, -n, -3): out.append(i)
+  for i in reversed(xrange(2, n, 2)): out.append(i)
+  for i in xrange(0): out.append(i)
+  for i in range(1, n, 4): out.append(i * i)
+  return out
+
+@wrap
+def shared_iterators(n):
+  out = []
+  it = iter(xrange(n))
+  for i in it:
+    if i == 3: break
+  for i in it: out.append(i)
+  for i in it: out.append(-1)
+
+  xs = range(n)
+  for x in xs:
+    if x < 3: xs.append(x + n)
+    out.append(x)
+  lit = iter(xs)
+  for x in lit: pass
+  xs.append(0)
+  for x in lit: out.append(x)
+  return out
+
+@wrap
+def large_range(base):
+  total = 0
+  for i in xrange(base, base + 4): total += i
+  for x in [base, base * base, None, 'a', 1.5]: total = (total, x)
+  return total
+
+def test_range_loops():
+  import sys
+  range_loops(10)
+  range_loops(0)
+  shared_iterators(8)
+  large_range(7)
+  large_range(sys.maxint - 4)
+  large_range(-sys.maxint - 1)
+
+@wrap
+def dict_loops(d):
+  out = []
+  for k, v in d.iteritems(): out.append((k, v))
+  for k in d.iterkeys(): out.append(k)
+  for v in d.itervalues(): out.append(v)
+  for k in d: out.append(k)
+  for k, v in d.items(): out.append(v)
+  return sorted(out)
+
+@wrap
+def pair_loops(n):
+  out = []
+  for a, b in [(i, i * i) for i in xrange(n)]: out.append(a + b)
+  for a, b in ((1, 2), [3, 4], 'ab', iter((5, 6))): out.append((a, b))
+  for a, a in [(1, 2)]: out.append(a)
+  pairs = zip(xrange(n), xrange(n, 0, -1))
+  for x, y in pairs:
+    out.append(x - y)
+    x = y = None
+  out.append(x)
+  return out
+
+@wrap
+def tuple_loop(t):
+  total = 0
+  for x in t: total += x
+  for i, x in enumerate(t): total += i * x
+  return total
+
+@wrap
+def bad_pairs(items):
+  out = []
+  try:
+    for a, b in items: out.append(a)
+  except (ValueError, TypeError) as e:
+    out.append(str(e))
+  return out
+
+@wrap
+def resized_dict(n):
+  d = dict.fromkeys(range(n))
+  try:
+    for k, v in d.iteritems(): d[k + n] = v
+  except RuntimeError as e:
+    return str(e)
+
+def test_collection_loops():
+  dict_loops(dict(a=1, b=2, c=3))
+  dict_loops(dict.fromkeys(range(100), 'x'))
+  dict_loops({})
+  pair_loops(10)
+  tuple_loop(tuple(range(20)))
+  tuple_loop(())
+  bad_pairs([(1, 2), (3,)])
+  bad_pairs([(1, 2), (3, 4, 5)])
+  bad_pairs([(1, 2), 3])
+  bad_pairs([(1, 2), ()])
+  resized_dict(5)
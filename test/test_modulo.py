@@ -29,3 +29,17 @@ def test_modulo():
   modulo("%s %s", ("a", "b"))
   modulo("%s %s", (1,2))
   
+
+@wrap
+def inplace_divmod(a, b):
+  q = a
+  q /= b
+  r = a
+  r %= b
+  return q, r
+
+def test_inplace_divmod():
+  inplace_divmod(7, 2)
+  inplace_divmod(-7, 2)
+  inplace_divmod(7, -2)
+  inplace_divmod(-7, -2)
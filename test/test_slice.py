@@ -86,3 +86,14 @@ def load_slice4():
 def test_load_slice4():
   load_slice4()
 
+
+@wrap
+def copy_twice():
+  x = range(10)
+  a = x[:]
+  b = x[:]
+  a.append(10)
+  return a, b, a is b
+
+def test_copy_twice():
+  copy_twice()
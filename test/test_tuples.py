@@ -19,4 +19,85 @@ def add_tuples(x,y):
   return a + b
 
 def test_add_tuples():
-  add_tuples(20,309.0)
\ No newline at end of file
+  add_tuples(20,309.0)
+
+def pair(x):
+  return x, x * 2
+
+@wrap
+def unpack_all(x):
+  a, b, c = x
+  d, e = pair(a)
+  f, (g, h) = b, pair(c)
+  x, y = list(x)[1:]
+  return a, b, c, d, e, f, g, h, x, y
+
+@wrap
+def unpack_many(x):
+  a, b, c, d, e, f, g, h, i, j = x
+  return j, i, h, g, f, e, d, c, b, a
+
+@wrap
+def unpack_errors(x):
+  try:
+    a, b = x
+    return a, b
+  except (ValueError, TypeError) as e:
+    return str(e)
+
+def test_unpack():
+  unpack_all((1, 2, 3))
+  unpack_all([1.5, 'b', 7])
+  unpack_all('abc'[:2] + 'c')
+  unpack_all(xrange(3))
+  unpack_many(range(10))
+  unpack_many(tuple('abcdefghij'))
+  unpack_errors((1,))
+  unpack_errors([1, 2, 3])
+  unpack_errors(())
+  unpack_errors(xrange(2))
+  unpack_errors(xrange(3))
+  unpack_errors(5)
+  unpack_errors(None)
+
+
+def divmod_pair(a, b):
+  return a // b, a % b
+
+def three(x):
+  return x, [x], (x,)
+
+def maybe_pair(x):
+  if x:
+    return x, x + 1
+  return None
+
+@wrap
+def multi_return(n):
+  out = []
+  for i in xrange(1, n):
+    q, r = divmod_pair(n, i)
+    a, b, c = three(i)
+    out.append((q, r, a, b, c, divmod_pair(i, n), maybe_pair(i - 1)))
+    try:
+      a, b, c = divmod_pair(i, n)
+    except ValueError as e:
+      out.append(str(e))
+    try:
+      a, b = maybe_pair(i - 1)
+    except TypeError as e:
+      out.append(str(e))
+  return out
+
+@wrap
+def local_tuples(a, b, c, d):
+  a, b, c, d = d, c, b, a
+  t = (a, b, c)
+  u = [a, b]
+  a = 0
+  return t[0] + t[-1] + u[1], t[1:], a, b, c, d
+
+def test_escape():
+  multi_return(6)
+  local_tuples(1, 2, 3, 4)
+  local_tuples('a', 'b', 'c', 'd')
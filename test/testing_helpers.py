@@ -1,5 +1,9 @@
 import falcon 
 
+# Compile functions called from compiled code on their first call, so the
+# tests exercise the register evaluator rather than CPython.
+falcon.evaluator.set_hot_threshold(1)
+
 class wrap(object):
   def __init__(self, f):
     self.python_fn = f